@@ -0,0 +1,176 @@
+/*
+ *  adc_bench.cpp
+ *
+ *  Description: Microbenchmark of ADC::Routine() latency against a fake spidev.  The
+ *  current routine, which converts all due channels in one SPI message, is compared with
+ *  the previous one that issued a separate message for every channel.  The last case is
+ *  jefebot's volt meter, which only subscribes to the battery channel once a second.
+ *
+ *  The table driven result decode is also checked bit for bit against the original shift
+ *  and mask decode for every pair of result bytes, then both are timed.
+ *
+ *  Synopsis:
+ *      adc_bench [iterations]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <stdint.h>
+#include "adc.h"
+#include "fake_spi.h"
+
+// the original shift and mask decode of the LSB first result bits
+static unsigned LegacyDecode(const uint8_t *inbuf)
+{
+	unsigned dcode;
+
+	dcode  = ((uint16_t)(inbuf[3]) << 3) & 0x0200;
+	dcode += ((uint16_t)(inbuf[3]) << 1) & 0x0100;
+	dcode += ((uint16_t)(inbuf[2]) << 7) & 0x0080;
+	dcode += ((uint16_t)(inbuf[2]) << 5) & 0x0040;
+	dcode += ((uint16_t)(inbuf[2]) << 3) & 0x0020;
+	dcode += ((uint16_t)(inbuf[2]) << 1) & 0x0010;
+	dcode += ((uint16_t)(inbuf[2]) >> 1) & 0x0008;
+	dcode += ((uint16_t)(inbuf[2]) >> 3) & 0x0004;
+	dcode += ((uint16_t)(inbuf[2]) >> 5) & 0x0002;
+	dcode += ((uint16_t)(inbuf[2]) >> 7) & 0x0001;
+
+	return dcode;
+}
+
+// expose the routine under test, plus the per-channel routine it replaced
+class BenchADC : public ADC
+{
+private:
+	unsigned legacyCodes[8];
+
+public:
+	using ADC::Decode;
+
+	BenchADC() : ADC(50)
+	{}
+	void SubscribeAll()
+	{
+		for (unsigned i = 0; i < 8; ++i)
+			Subscribe(i, 50);
+	}
+	void Routine()
+	{
+		ADC::Routine();
+	}
+	void LegacyRoutine()
+	{
+		unsigned dcode;
+		uint8_t inbuf[4];
+		uint8_t outbuf[4];
+
+		struct spi_ioc_transfer tr =
+		{
+			tr.tx_buf = (unsigned long)outbuf,
+			tr.rx_buf = (unsigned long)inbuf,
+			tr.len = 4,
+			tr.delay_usecs = 0,
+		};
+
+		for (int i = 0; i < 8; i++)
+		{
+			outbuf[0] = 0xc0 | (i << 3);
+			outbuf[1] = outbuf[2] = outbuf[3] = 0;
+			if (SPITransfer(fd, &tr, 1) == -1)
+			{
+				throw DP::FrameworkException("ADC", ERR_READ);
+			}
+			dcode = LegacyDecode(inbuf);
+			legacyCodes[i] = dcode;
+		}
+	}
+};
+
+static double Now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+template <typename F>
+static void Run(const char* name, unsigned iterations, F routine)
+{
+	double best = 1e18;
+	double total;
+
+	fakeSpiMessages = fakeSpiTransfers = 0;
+	double start = Now_ns();
+	for (unsigned i = 0; i < iterations; ++i)
+	{
+		double t0 = Now_ns();
+		routine();
+		double dt = Now_ns() - t0;
+		if (dt < best)
+			best = dt;
+	}
+	total = Now_ns() - start;
+
+	printf("%-24s %10.0f ns/call (min %6.0f)  %4.1f messages/call  %4.1f transfers/call\n",
+		name, total / iterations, best,
+		(double)fakeSpiMessages / iterations, (double)fakeSpiTransfers / iterations);
+}
+
+// compare the decodes for all 2^16 values of bytes 2 and 3
+static bool VerifyDecode()
+{
+	uint8_t inbuf[4] = {0, 0, 0, 0};
+
+	for (unsigned v = 0; v < 0x10000; ++v)
+	{
+		inbuf[2] = v & 0xff;
+		inbuf[3] = v >> 8;
+		if (BenchADC::Decode(inbuf) != LegacyDecode(inbuf))
+		{
+			printf("decode mismatch: bytes %02x %02x -> %03x, expected %03x\n",
+				inbuf[2], inbuf[3], BenchADC::Decode(inbuf), LegacyDecode(inbuf));
+			return false;
+		}
+	}
+	printf("decode verified for all 65536 byte pairs\n");
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	unsigned iterations = (argc > 1) ? atoi(argv[1]) : 100000;
+	BenchADC adc;
+	BenchADC voltMeter;
+
+	adc.SubscribeAll();
+	voltMeter.Subscribe(7, 1000);
+
+	volatile unsigned sink = 0;
+	uint8_t inbuf[4] = {0, 0, 0, 0};
+
+	if (!VerifyDecode())
+		return 1;
+
+	Run("decode shift/mask x256", iterations, [&]() {
+		for (unsigned v = 0; v < 256; ++v)
+		{
+			inbuf[2] = v;
+			inbuf[3] = v;
+			sink = sink + LegacyDecode(inbuf);
+		}
+	});
+	Run("decode table x256", iterations, [&]() {
+		for (unsigned v = 0; v < 256; ++v)
+		{
+			inbuf[2] = v;
+			inbuf[3] = v;
+			sink = sink + BenchADC::Decode(inbuf);
+		}
+	});
+	Run("ADC::Routine per-channel", iterations, [&]() { adc.LegacyRoutine(); });
+	Run("ADC::Routine batched", iterations, [&]() { adc.Routine(); });
+	Run("ADC::Routine battery only", iterations, [&]() { voltMeter.Routine(); });
+
+	return 0;
+}
@@ -0,0 +1,16 @@
+/*
+ *  fake_spi.h
+ *
+ *  Description: Fake spidev transport for the benchmarks, see fake_spi.cpp.
+ */
+
+#ifndef BENCH_FAKE_SPI_H_
+#define BENCH_FAKE_SPI_H_
+
+#include "spi.h"
+
+// message and transfer counters
+extern unsigned long fakeSpiMessages;
+extern unsigned long fakeSpiTransfers;
+
+#endif /* BENCH_FAKE_SPI_H_ */
@@ -0,0 +1,326 @@
+/*
+ *  jefebot_bench.cpp
+ *
+ *  Description: Microbenchmark suite of jefebot's control path.  It runs on the simulated
+ *  DP peripherals, so it needs neither dpserver nor the hardware.  First, missions of
+ *  both controllers are flown on the table-top model, and every call below is timed in
+ *  place:
+ *      - RoamController::Routine and GotoObjectController::Routine, per controller state;
+ *        the routine that ends a mission is timed under the state that ended it
+ *      - Locomotive::Handler and EdgeDetector::Handler
+ *  Then these are timed in a loop:
+ *      - EdgeDetector::AtAnyEdge, over the sensor frames seen during the missions
+ *      - EdgeDetector::ToDistance_cm, over the ADC812's whole range
+ *      - ADC::Routine with all 8 channels due, and ADC::Decode
+ *  The results go to stdout as JSON, for tracking regressions between releases.  There
+ *  is one entry per case, giving its call count and the min, mean, p50, p99 and max
+ *  time per call in nS.  The looped cases are timed in batches of BatchSize calls.
+ *
+ *  The missions use jefebot's default limits and speed.  Each one uses a different noise
+ *  seed and, for GotoObject, a different object position.  A state a routine was never
+ *  timed in is reported on stderr and fails the run.
+ *
+ *  Synopsis:
+ *      jefebot_bench [missions]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "dp_events.h"
+#include "sim_world.h"
+#include "peripherals.h"
+#include "roam_controller.h"
+#include "goto_object_controller.h"
+#include "latency.h"
+#include "profiler.h"
+
+static const unsigned EdgeLimit = 1000;
+static const unsigned InnerLimit = 40;
+static const unsigned OuterLimit = 1000;
+static const float Speed = 35.0;
+static const unsigned BattChannel = 7;
+static const float BattDivider = 4;
+static const BatteryEstimator::Pack BattPack = {3, 1.0, 0.3, 0.25, 1.5, 10.0};
+
+static const double RoamSeconds = 60.0;
+static const double GotoSeconds = 30.0;
+static const unsigned BatchSize = 1000;
+static const unsigned MaxFrames = 4096;
+
+// object positions for the GotoObject missions, cm; the first is pushed off the table and
+// the mission ends in COMPLETE, the second leads the bot onto a side edge and the mission
+// ends in AVOID_EDGE, so two missions or more reach every state
+static const double Objects[][2] = {{110, 50}, {40, 20}, {120, 15}, {30, 60}, {75, 65}};
+
+// the states every controller's routine is to be timed in
+static const char* RoamStates[] = {"ROAM", "AVOID_EDGE"};
+static const char* GotoStates[] =
+{
+	"ESTABLISH_RANGE", "TURN_TO_OBJECT", "GOTO_OBJECT", "PUSH_OBJECT", "AVOID_EDGE", "PREVENT_FALLING", "COMPLETE"
+};
+
+struct BenchCase
+{
+	const char* name;
+	const char* state;
+	LatencyHistogram times;		// nS per call
+};
+
+static std::vector<BenchCase*> cases;
+static std::vector<SensorFrame> frames;
+
+// the times of a case, created the first time it is seen
+static LatencyHistogram& CaseTimes(const char* name, const char* state = "")
+{
+	for (size_t i = 0; i < cases.size(); ++i)
+	{
+		if (strcmp(cases[i]->name, name) == 0 && strcmp(cases[i]->state, state) == 0)
+			return cases[i]->times;
+	}
+
+	BenchCase* c = new BenchCase;
+	c->name = name;
+	c->state = state;
+	cases.push_back(c);
+	return c->times;
+}
+
+// warn of each of the states a routine was never timed in, returning how many
+static unsigned CheckStates(const char* name, const char* const* states, unsigned numStates)
+{
+	unsigned numMissing = 0;
+
+	for (unsigned i = 0; i < numStates; ++i)
+	{
+		if (CaseTimes(name, states[i]).Count() == 0)
+		{
+			fprintf(stderr, "jefebot_bench: %s was never timed in %s\n", name, states[i]);
+			++numMissing;
+		}
+	}
+	return numMissing;
+}
+
+// a mission ends when the controller shuts jefebot down
+struct MissionEnd
+{};
+
+void Shutdown()
+{
+	throw MissionEnd();
+}
+
+void Shutdown(const char* msg, int error)
+{
+	throw MissionEnd();
+}
+
+// a controller whose routine is timed under the state it runs in
+template <class C>
+class TimedController : public C
+{
+private:
+	const char* name;
+
+public:
+	TimedController(Controller::Context& ctx, const char* _name) : C(ctx, false), name(_name)
+	{}
+	void Routine()
+	{
+		LatencyHistogram& times = CaseTimes(name, this->StateName());
+		uint64_t start_ns = Profiler::Now_ns();
+
+		// the routine that ends the mission is timed under the state it ended in, whose
+		// entry action shut jefebot down
+		try
+		{
+			C::Routine();
+		}
+		catch (MissionEnd&)
+		{
+			CaseTimes(name, this->StateName()).Record(Profiler::Now_ns() - start_ns);
+			throw;
+		}
+		times.Record(Profiler::Now_ns() - start_ns);
+	}
+};
+
+class TimedLocomotive : public Locomotive
+{
+public:
+	TimedLocomotive(DP::EventContext& evtCtx, SensorFrameBuffer& sensors) : Locomotive(evtCtx, sensors, Speed)
+	{}
+	void Handler()
+	{
+		LatencyHistogram& times = CaseTimes("Locomotive::Handler");
+		uint64_t start_ns = Profiler::Now_ns();
+		Locomotive::Handler();
+		times.Record(Profiler::Now_ns() - start_ns);
+	}
+};
+
+// also keeps the frames it publishes for the AtAnyEdge loop
+class TimedEdgeDetector : public EdgeDetector
+{
+private:
+	SensorFrameBuffer& sensors;
+
+public:
+	TimedEdgeDetector(DP::EventContext& evtCtx, SensorFrameBuffer& _sensors) :
+		EdgeDetector(evtCtx, _sensors, EdgeLimit), sensors(_sensors)
+	{}
+	void Handler()
+	{
+		LatencyHistogram& times = CaseTimes("EdgeDetector::Handler");
+		uint64_t start_ns = Profiler::Now_ns();
+		EdgeDetector::Handler();
+		times.Record(Profiler::Now_ns() - start_ns);
+
+		if (frames.size() < MaxFrames)
+		{
+			SensorFrame frame;
+			sensors.Read(&frame);
+			frames.push_back(frame);
+		}
+	}
+};
+
+// expose the routine and the decode under test
+class BenchADC : public ADC
+{
+public:
+	using ADC::Decode;
+
+	BenchADC() : ADC(50)
+	{
+		for (unsigned i = 0; i < 8; ++i)
+			Subscribe(i, 50);
+	}
+	void Routine()
+	{
+		ADC::Routine();
+	}
+};
+
+template <class C>
+static void FlyMission(const Sim::Config& config, const char* name)
+{
+	Sim::World world(config);
+	DP::EventContext evtCtx(world);
+	SensorFrameBuffer sensors;
+	UserInterface ui(evtCtx);
+	TimedEdgeDetector edgeDetector(evtCtx, sensors);
+	SinglePingRangeSensor rangeSensor(evtCtx, sensors, InnerLimit, OuterLimit);
+	VoltMeter voltMeter(evtCtx, sensors, BattChannel, BattDivider, BattPack);
+	TimedLocomotive locomotive(evtCtx, sensors);
+
+	voltMeter.SetLocomotive(&locomotive);
+	Controller::Context ctx(ui, locomotive, edgeDetector, rangeSensor, sensors);
+	TimedController<C> controller(ctx, name);
+	evtCtx.Register(&controller);
+
+	try
+	{
+		evtCtx.Run((unsigned long)(config.duration * 1000));
+	}
+	catch (MissionEnd&)
+	{
+	}
+}
+
+// time a routine in batches, recording the mean time per call of each batch
+template <typename F>
+static void Loop(const char* name, unsigned batches, F routine)
+{
+	LatencyHistogram& times = CaseTimes(name);
+
+	for (unsigned b = 0; b < batches; ++b)
+	{
+		uint64_t start_ns = Profiler::Now_ns();
+		for (unsigned i = 0; i < BatchSize; ++i)
+			routine(i);
+		times.Record((Profiler::Now_ns() - start_ns) / BatchSize);
+	}
+}
+
+static void PrintJSON(FILE* fp, unsigned missions)
+{
+	fprintf(fp, "{\n  \"suite\": \"jefebot\",\n  \"missions\": %u,\n  \"cases\": [\n", missions);
+	for (size_t i = 0; i < cases.size(); ++i)
+	{
+		const BenchCase* c = cases[i];
+		fprintf(fp,
+			"    {\"name\": \"%s\", \"state\": \"%s\", \"calls\": %lu, \"min_ns\": %llu, \"mean_ns\": %llu, "
+			"\"p50_ns\": %llu, \"p99_ns\": %llu, \"max_ns\": %llu}%s\n",
+			c->name, c->state, c->times.Count(),
+			(unsigned long long)c->times.Min(), (unsigned long long)c->times.Mean(),
+			(unsigned long long)c->times.Percentile(0.5), (unsigned long long)c->times.Percentile(0.99),
+			(unsigned long long)c->times.Max(), (i + 1 < cases.size()) ? "," : "");
+	}
+	fprintf(fp, "  ]\n}\n");
+}
+
+int main(int argc, char* argv[])
+{
+	unsigned missions = (argc > 1) ? atoi(argv[1]) : 5;
+	Sim::Config config;
+	volatile unsigned sink = 0;
+
+	for (unsigned m = 0; m < missions; ++m)
+	{
+		config.seed = m + 1;
+		config.duration = RoamSeconds;
+		FlyMission<RoamController>(config, "RoamController::Routine");
+
+		config.duration = GotoSeconds;
+		config.objectX = Objects[m % 5][0];
+		config.objectY = Objects[m % 5][1];
+		FlyMission<GotoObjectController>(config, "GotoObjectController::Routine");
+	}
+
+	// the edge detector's limits, on a detector nothing else drives
+	{
+		Sim::World world(config);
+		DP::EventContext evtCtx(world);
+		SensorFrameBuffer sensors;
+		EdgeDetector edgeDetector(evtCtx, sensors, EdgeLimit);
+		EdgeDetector::EDGE_SENSORS edge;
+
+		if (!frames.empty())
+		{
+			Loop("EdgeDetector::AtAnyEdge", 1000, [&](unsigned i) {
+				sink = sink + edgeDetector.AtAnyEdge(frames[i % frames.size()], &edge);
+			});
+		}
+		Loop("EdgeDetector::ToDistance_cm", 1000, [&](unsigned i) {
+			sink = sink + EdgeDetector::ToDistance_cm((i * 7) % (DP::ADC812::FullScale_mV + 1));
+		});
+	}
+
+	// the sim's MCP3008 reads the battery from a world
+	{
+		Sim::World world(config);
+		BenchADC adc;
+		uint8_t inbuf[4] = {0, 0, 0, 0};
+
+		Loop("ADC::Routine", 100, [&](unsigned i) {
+			adc.Routine();
+		});
+		Loop("ADC::Decode", 1000, [&](unsigned i) {
+			inbuf[2] = i;
+			inbuf[3] = i >> 8;
+			sink = sink + BenchADC::Decode(inbuf);
+		});
+	}
+
+	PrintJSON(stdout, missions);
+
+	// every state is timed, or the run fails
+	unsigned numMissing =
+		CheckStates("RoamController::Routine", RoamStates, sizeof(RoamStates) / sizeof(RoamStates[0])) +
+		CheckStates("GotoObjectController::Routine", GotoStates, sizeof(GotoStates) / sizeof(GotoStates[0]));
+
+	return numMissing ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,194 @@
+/*
+ *  pipeline_bench.cpp
+ *
+ *  Description: Benchmark of the sensor to actuator latency of jefebot's control path,
+ *  run on the event loop as it is by default against run on a control thread with the
+ *  logging on a thread of its own, see pipeline.h and logger.h.  Each is flown as a Roam
+ *  mission on the simulated dpserver running in real time, so the packets arrive when
+ *  they would on the robot, and a packet that waits for the event loop is late by as much.
+ *
+ *  Each is flown twice: quiet, and under a logging load, a verbose controller and a line
+ *  of the sensor values every 100 mS as -p s prints them, to a model of the Pi's serial
+ *  console: 115200 baud, so a line of 80 characters takes 7 mS to write.
+ *
+ *  The latency of an event is from the time the simulated dpserver sent its packet, or
+ *  its timer was due, to the end of its control work, any motor commands included:
+ *      - odometry: a Count4 update, through dead reckoning and the PIDs to the DC2
+ *      - edge:     a new edge, through the controller's decision to the DC2
+ *      - tick:     the controller's period
+ *  The results go to stdout as JSON: one entry per run and event type, giving its count
+ *  and the min, mean, p50, p99 and max latency in uS.  With -R the bench runs as jefebot
+ *  does with -R, see realtime.h, and the control thread shares its scheduling.
+ *
+ *  Synopsis:
+ *      pipeline_bench [-R] [seconds per run]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include "dp_events.h"
+#include "sim_world.h"
+#include "peripherals.h"
+#include "roam_controller.h"
+#include "pipeline.h"
+#include "logger.h"
+#include "realtime.h"
+
+static const unsigned EdgeLimit = 1000;
+static const unsigned InnerLimit = 40;
+static const unsigned OuterLimit = 1000;
+static const float Speed = 35.0;
+static const unsigned BattChannel = 7;
+static const float BattDivider = 4;
+static const BatteryEstimator::Pack BattPack = {3, 1.0, 0.3, 0.25, 1.5, 10.0};
+
+// a character on the serial console: a start bit, 8 data bits and a stop bit at 115200 baud
+static const long ConsoleCharTime_ns = 10 * 1000000000L / 115200;
+
+static const char* EventNames[ControlPipeline::Event::NUM_TYPES] = {"odometry", "edge", "tick", "stop"};
+
+// a Roam mission never shuts down by itself, nor does the bench
+void Shutdown()
+{}
+
+void Shutdown(const char* msg, int error)
+{}
+
+// the serial console takes as long to write a line as it has characters
+static ssize_t ConsoleWrite(void* cookie, const char* buf, size_t size)
+{
+	long delay_ns = ConsoleCharTime_ns * size;
+	struct timespec delay = {delay_ns / 1000000000, delay_ns % 1000000000};
+
+	nanosleep(&delay, 0);
+	return size;
+}
+
+static FILE* OpenConsole()
+{
+	cookie_io_functions_t functions = {0, ConsoleWrite, 0, 0};
+	return fopencookie(0, "w", functions);
+}
+
+// the sensor values, as -p s prints them
+class SensorLog : public DP::Callback
+{
+private:
+	SensorFrameBuffer& sensors;
+
+public:
+	SensorLog(SensorFrameBuffer& _sensors) : DP::Callback(100), sensors(_sensors)
+	{}
+	void Routine()
+	{
+		SensorFrame frame;
+
+		sensors.Read(&frame);
+		logger.Print("range value=%u  edge sensors: 1=%u 2=%u 3=%u  battery %.2f V, pose (%.1f, %.1f)\n",
+			frame.distance, frame.edge_mV[0], frame.edge_mV[1], frame.edge_mV[2], frame.batteryVoltage,
+			frame.pose.x, frame.pose.y);
+	}
+};
+
+struct Run
+{
+	const char* name;
+	bool isThreaded;
+	bool isLogging;
+	LatencyHistogram latencies[ControlPipeline::Event::NUM_TYPES];
+	bool hasFallen;
+};
+
+static void FlyMission(const Sim::Config& config, Run& run)
+{
+	Sim::World world(config);
+	DP::EventContext evtCtx(world);
+	SensorFrameBuffer sensors;
+	UserInterface ui(evtCtx);
+	EdgeDetector edgeDetector(evtCtx, sensors, EdgeLimit);
+	SinglePingRangeSensor rangeSensor(evtCtx, sensors, InnerLimit, OuterLimit);
+	VoltMeter voltMeter(evtCtx, sensors, BattChannel, BattDivider, BattPack);
+	Locomotive locomotive(evtCtx, sensors, Speed);
+	SensorLog sensorLog(sensors);
+
+	voltMeter.SetLocomotive(&locomotive);
+	Controller::Context ctx(ui, locomotive, edgeDetector, rangeSensor, sensors);
+	RoamController controller(ctx, run.isLogging);
+
+	// wired as jefebot wires it
+	ControlPipeline pipeline(locomotive);
+	pipeline.SetController(&controller);
+	edgeDetector.SetEdgeHandler(&pipeline);
+	locomotive.SetPipeline(&pipeline);
+	evtCtx.Register(&pipeline);
+	if (run.isLogging)
+		evtCtx.Register(&sensorLog);
+
+	evtCtx.SetRealTime(true);
+	if (run.isThreaded)
+	{
+		logger.Start();
+		pipeline.Start();
+	}
+
+	evtCtx.Run((unsigned long)(config.duration * 1000));
+
+	pipeline.Stop();
+	logger.Stop();
+	for (unsigned i = 0; i < ControlPipeline::Event::NUM_TYPES; ++i)
+		run.latencies[i] = pipeline.GetLatencies((ControlPipeline::Event::TYPE)i);
+	run.hasFallen = world.HasFallen();
+}
+
+static void PrintJSON(FILE* fp, double seconds, const Run* runs, unsigned numRuns)
+{
+	fprintf(fp, "{\n  \"suite\": \"pipeline\",\n  \"seconds\": %.0f,\n  \"cases\": [\n", seconds);
+	for (unsigned r = 0; r < numRuns; ++r)
+	{
+		for (unsigned i = 0; i < ControlPipeline::Event::STOP; ++i)
+		{
+			const LatencyHistogram& h = runs[r].latencies[i];
+			bool isLast = (r + 1 == numRuns && i + 1 == ControlPipeline::Event::STOP);
+
+			fprintf(fp,
+				"    {\"name\": \"%s\", \"event\": \"%s\", \"fell\": %s, \"count\": %lu, \"min_us\": %llu, "
+				"\"mean_us\": %llu, \"p50_us\": %llu, \"p99_us\": %llu, \"max_us\": %llu}%s\n",
+				runs[r].name, EventNames[i], runs[r].hasFallen ? "true" : "false", h.Count(),
+				(unsigned long long)h.Min(), (unsigned long long)h.Mean(),
+				(unsigned long long)h.Percentile(0.5), (unsigned long long)h.Percentile(0.99),
+				(unsigned long long)h.Max(), isLast ? "" : ",");
+		}
+	}
+	fprintf(fp, "  ]\n}\n");
+}
+
+int main(int argc, char* argv[])
+{
+	Sim::Config config;
+	Run runs[] =
+	{
+		{"serial", false, false},
+		{"threaded", true, false},
+		{"serial, logging", false, true},
+		{"threaded, logging", true, true}
+	};
+	const unsigned numRuns = sizeof(runs) / sizeof(runs[0]);
+	int arg = 1;
+
+	if (arg < argc && strcmp(argv[arg], "-R") == 0)
+	{
+		EnterRealtime(stderr);
+		++arg;
+	}
+	config.duration = (arg < argc) ? atof(argv[arg]) : 15.0;
+	logger.SetFile(OpenConsole());
+
+	for (unsigned r = 0; r < numRuns; ++r)
+		FlyMission(config, runs[r]);
+
+	PrintJSON(stdout, config.duration, runs, numRuns);
+
+	return 0;
+}
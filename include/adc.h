@@ -3,8 +3,13 @@
  *
  *  Description: Class to implement an ADC on Raspberry Pi SPI device 0
  *
+ *  Only the channels that a consumer has subscribed to are converted, each at its own
+ *  sampling period, so unused channels cost neither bus time nor CPU.
+ *
  *  Interface:
- *    - GetVoltage(): Read the current voltage of the battery
+ *    - Subscribe(): start sampling a channel every period mS
+ *    - Unsubscribe(): stop sampling a channel
+ *    - GetVoltage(): Read the current voltage of a channel, e.g. the battery
  *
  *  Created on: Mar 2, 2017
  *      Author: jeff
@@ -14,24 +19,51 @@
 #define INCLUDE_ADC_H_
 
 #include "dp_events.h"
+#include "spi.h"
 
 #define SPI_DEV_0 "/dev/spidev0.0"
 
 class ADC : public DP::GenericSensor
 {
 private:
+	const static unsigned NumChannels = 8;
+	const static unsigned TransferLen = 4;
+	constexpr static float VoltsPerCode = 3.3 / 1024;
+
 	const char *spiDevId;
-	unsigned digitalCodes[8];
+	unsigned period;
+	unsigned long elapsed;					// mS since the ADC started
+	unsigned digitalCodes[NumChannels];
+	unsigned sampleCounts[NumChannels];
+	float voltages[NumChannels];			// calibrated once per sample
+	unsigned samplePeriods[NumChannels];	// mS, 0 if not subscribed
+	unsigned long dueTimes[NumChannels];
+
+	// one conversion per channel, the due ones are submitted to spidev as a single message
+	struct spi_ioc_transfer transfers[NumChannels];
+	struct spi_ioc_transfer batch[NumChannels];
+	unsigned batchChannels[NumChannels];
+	uint8_t outbufs[NumChannels][TransferLen];
+	uint8_t inbufs[NumChannels][TransferLen];
 
 	int InitSPI(const char *dev);
 
 protected:
+	// decode the 10-bit result from the LSB first bits in bytes 2 and 3 of a transfer
+	static unsigned Decode(const uint8_t *inbuf);
+
     // get the actual digital code value from the ADC device
 	int GetDigitalCode(unsigned channel)
 	{
 		return digitalCodes[channel];
 	}
 	
+	// the number of times a channel has been sampled
+	unsigned GetSampleCount(unsigned channel)
+	{
+		return sampleCounts[channel];
+	}
+	
 	// event handler for the ADC object
 	void Routine();
 
@@ -39,9 +71,15 @@ public:
 	ADC(unsigned _period);
 	virtual ~ADC()
 	{}
+
+	// sample a channel every samplePeriod mS, rounded up to the period of the ADC itself;
+	// the first sample is taken on the next run of the ADC
+	void Subscribe(unsigned channel, unsigned samplePeriod);
+	void Unsubscribe(unsigned channel);
+
 	float GetVoltage(unsigned channel)
 	{
-		return ((digitalCodes[channel] * 3.3) / 1024);
+		return voltages[channel];
 	}
 };
 
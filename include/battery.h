@@ -0,0 +1,108 @@
+/*
+ *  battery.h
+ *
+ *  Description: State of charge estimator for jefebot's LiPo pack.  A single terminal
+ *  voltage sample is a poor measure of the pack: it sags by the load current times the
+ *  pack's internal resistance whenever the motors draw, and it is noisy.  So each sample
+ *  is first compensated for the load, estimated from the motor powers, to an open
+ *  circuit voltage, which is then low pass filtered.  The state of charge comes from the
+ *  filtered voltage through the LiPo discharge curve, and the runtime left from the
+ *  charge above the cutoff at the filtered load current.
+ *
+ *  The pack is at one of 4 levels, which only ever go up:
+ *    - OK:       the runtime left is at least LowRuntime
+ *    - LOW:      less than LowRuntime is left, time to head for home
+ *    - CRITICAL: less than CriticalRuntime is left, time to stop
+ *    - CUTOFF:   the filtered voltage is below the cutoff, the cells are being damaged
+ *  and each level has the period the pack should be sampled at, quicker as it runs down.
+ *
+ *  Interface:
+ *    - Current(): the load current of the motors at their modes and powers
+ *    - Update(): add a sample of the terminal voltage at a load current
+ *    - GetVoltage(), GetStateOfCharge(), GetRuntime(), GetLevel(), GetSamplePeriod()
+ */
+
+#ifndef INCLUDE_BATTERY_H_
+#define INCLUDE_BATTERY_H_
+
+#include <stdint.h>
+
+class BatteryEstimator
+{
+public:
+	// the pack and what draws on it
+	struct Pack
+	{
+		unsigned cells;
+		float capacity_Ah;
+		float resistance;		// internal, ohms
+		float idleCurrent;		// A with the motors stopped
+		float motorCurrent;		// A per motor at 100% power
+		float cutoffVoltage;
+	};
+
+	enum LEVEL {BATTERY_OK, BATTERY_LOW, BATTERY_CRITICAL, BATTERY_CUTOFF, NUM_LEVELS};
+
+private:
+	// filter time constants in S
+	constexpr static float VoltageTau = 5.0;
+	constexpr static float CurrentTau = 30.0;
+	// runtime left at the LOW and CRITICAL levels in S
+	constexpr static float LowRuntime = 300.0;
+	constexpr static float CriticalRuntime = 60.0;
+	// sample period at each level in mS
+	constexpr static unsigned SamplePeriods[NUM_LEVELS] = {2000, 500, 100, 100};
+
+	Pack pack;
+	float cutoffCharge;			// the state of charge at the cutoff voltage
+	uint64_t lastTime_us;		// of the last sample, 0 before the first
+	float voltage;				// filtered open circuit
+	float current;				// filtered load
+	float stateOfCharge;
+	float runtime;
+	LEVEL level;
+
+	static float ChargeOf(float cellVoltage);
+
+public:
+	BatteryEstimator(const Pack& pack);
+
+	// the load current of the motors, from their DC2 modes and powers
+	float Current(const char modes[2], const float powers[2]) const;
+
+	// add a sample of the terminal voltage taken at a load current, returning the level
+	LEVEL Update(uint64_t time_us, float terminalVoltage, float loadCurrent);
+
+	bool IsSampled() const
+	{
+		return lastTime_us != 0;
+	}
+	// the filtered open circuit voltage
+	float GetVoltage() const
+	{
+		return voltage;
+	}
+	// 0..1
+	float GetStateOfCharge() const
+	{
+		return stateOfCharge;
+	}
+	// S until the cutoff at the filtered load
+	float GetRuntime() const
+	{
+		return runtime;
+	}
+	LEVEL GetLevel() const
+	{
+		return level;
+	}
+	// mS between samples at the current level
+	unsigned GetSamplePeriod() const
+	{
+		return SamplePeriods[level];
+	}
+
+	static const char* LevelName(LEVEL level);
+};
+
+#endif /* INCLUDE_BATTERY_H_ */
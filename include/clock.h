@@ -0,0 +1,28 @@
+/*
+ *  clock.h
+ *
+ *  Description: Monotonic time source used to timestamp sensor samples and events.  The
+ *  real implementation in clock.cpp reads CLOCK_MONOTONIC; the simulated backend in sim/
+ *  supplies its own that reads the virtual clock, so timestamps stay meaningful when a
+ *  mission runs faster than real time.
+ *
+ *  PacketArrival_ns() is for measuring latencies on the CPU's clock, see pipeline.h.  On
+ *  the robot it is the time the handler of a packet or timer asks, so it misses any time
+ *  the packet waited in the socket to be read; the simulated dpserver, when it runs in
+ *  real time, knows when it sent the packet and gives that instead.
+ *
+ *  Interface:
+ *    - MonotonicTime_us(): the current time in microseconds from an arbitrary epoch
+ *    - PacketArrival_ns(): when the packet or timer being handled arrived, in nanoseconds
+ *      on the same clock as Profiler::Now_ns()
+ */
+
+#ifndef INCLUDE_CLOCK_H_
+#define INCLUDE_CLOCK_H_
+
+#include <stdint.h>
+
+uint64_t MonotonicTime_us();
+uint64_t PacketArrival_ns();
+
+#endif /* INCLUDE_CLOCK_H_ */
@@ -8,32 +8,76 @@
  *          - locomotive:        the locomotive object
  *          - edgeDetector:      the edge detector object
  *          - rangeSensor:       the range sensor object
+ *          - sensors:           the sensor frame published by the peripherals
+ *          - frame:             the sensor frame read at the start of the current tick
  *          - ifVerbose:         degree of verbosity flag
  *          - edge:              ???
- *          - distanceToMove:    distance variable
- *          - angleToTurn:       angle variable
+ *
+ *      Besides running every Period mS, a controller is run immediately whenever the edge
+ *      detector sees a new edge, so it can react without waiting for its next period.
+ *      Either can be on the control thread, see pipeline.h, so a controller only reads
+ *      the sensors through its frame and logs through the Logger.
+ *
+ *      Controllers are StateMachines, see state_machine.h, traced by ControllerTracer, which
+ *      records every transition in the flight recorder and the telemetry and prints it
+ *      when verbose.
  */
 
 #ifndef INCLUDE_CONTROLLER_H_
 #define INCLUDE_CONTROLLER_H_
 
 #include "peripherals.h"
+#include "state_machine.h"
+#include "flight_recorder.h"
+#include "telemetry.h"
+#include "logger.h"
 #define PI 3.14
 
-class Controller : public DP::Callback
+class ControllerTracer
 {
 private:
+	RECORD_SOURCE source;
+	bool isVerbose;
+
+public:
+	ControllerTracer(RECORD_SOURCE _source, bool _isVerbose) : source(_source), isVerbose(_isVerbose)
+	{}
+
+	template <class Row>
+	void Started(const Row& row)
+	{
+		telemetry.StateChanged(source, row.state, row.name);
+		if (isVerbose) logger.Print("changing state to %s\n", row.name);
+	}
+	template <class Row>
+	void Changed(const Row& from, const Row& to)
+	{
+		flightRecorder.StateChanged(source, from.state, to.state);
+		telemetry.StateChanged(source, to.state, to.name);
+		if (isVerbose) logger.Print("changing state to %s\n", to.name);
+	}
+};
+
+class Controller : public DP::Callback, public EdgeDetector::EdgeHandler
+{
+public:
     static const unsigned Period = 50;
 
 protected:
     UserInterface& ui;
 	Locomotive& locomotive;
 	EdgeDetector& edgeDetector;
-	SinglePingRangeSensor& rangeSensor;
+	MultiPingRangeSensor& rangeSensor;
+	SensorFrameBuffer& sensors;
+	SensorFrame frame;
 	bool isVerbose;
 	enum EdgeDetector::EDGE_SENSORS edge;
-	int distanceToMove;
-	float angleToTurn;
+
+	// take the snapshot of the sensors that all decisions in this tick are made from
+	void ReadSensors()
+	{
+		sensors.Read(&frame);
+	}
 
 public:
 	struct Context
@@ -41,18 +85,29 @@ public:
 	    UserInterface& ui;
 		Locomotive& locomotive;
 		EdgeDetector& edgeDetector;
-		SinglePingRangeSensor& rangeSensor;
+		MultiPingRangeSensor& rangeSensor;
+		SensorFrameBuffer& sensors;
 		Context(
 			UserInterface& _ui,
 			Locomotive& _locomotive,
 			EdgeDetector& _edgeDetector,
-			SinglePingRangeSensor& _rangeSensor
-		) : ui(_ui), locomotive(_locomotive), edgeDetector(_edgeDetector), rangeSensor(_rangeSensor)
+			MultiPingRangeSensor& _rangeSensor,
+			SensorFrameBuffer& _sensors
+		) : ui(_ui), locomotive(_locomotive), edgeDetector(_edgeDetector), rangeSensor(_rangeSensor), sensors(_sensors)
 		{}
 	};
 
 	Controller(Context& ctx, bool _isVerbose);
-	virtual ~Controller()
+	virtual ~Controller();
+
+	// edge crossing event handler, runs the controller now
+	void OnEdge(enum EdgeDetector::EDGE_SENSORS edge);
+
+	// the name of the current state
+	virtual const char* StateName() const = 0;
+
+	// print how long the controller spent in each of its states
+	virtual void PrintStateTimes(FILE* fp) const
 	{}
 };
 
@@ -0,0 +1,166 @@
+/*
+ *  flight_recorder.h
+ *
+ *  Description: Binary flight recorder.  Every sensor sample, every motor command, the
+ *  speed regulator's error and every controller state transition is written as a fixed
+ *  size record into a ring that is memory mapped from a file.  A record is a plain store
+ *  into the mapping, so the hot path makes no system calls, and because the mapping is
+ *  shared the kernel keeps the last Capacity records on disk even if jefebot dies
+ *  without shutting down.
+ *
+ *  File layout: a FlightRecorderHeader followed by capacity FlightRecords.  head counts
+ *  every record ever written; record n lives at index n % capacity.  All values are
+ *  int32s whose meaning and scale depend on the record type, see RECORD_TYPE.
+ *
+ *  Interface:
+ *    - Open(): map the ring file, creating or truncating it; Close(): sync and unmap it
+ *    - Edges(), Range(), Odometry(), Battery(): sensor samples
+ *    - MotorMode(), MotorPower(), SpeedError(): Locomotive's motor commands
+ *    - StateChanged(): a controller state transition
+ *    - Shutdown(): a shutdown request, which a replay repeats at its recorded time
+ *  There is a single instance, flightRecorder; when it is not open a record costs a
+ *  branch.  The decoder, tools/flight_decode.cpp, dumps a ring file as CSV.
+ */
+
+#ifndef INCLUDE_FLIGHT_RECORDER_H_
+#define INCLUDE_FLIGHT_RECORDER_H_
+
+#include <stdint.h>
+#include <cstring>
+#include <atomic>
+
+// record types and the meaning of their values
+enum RECORD_TYPE
+{
+	FR_NONE = 0,		// never written
+	FR_EDGES,			// edge sensors mV: left, front, right
+	FR_RANGE,			// source = PING4 sensor: distance
+	FR_ODOMETRY,		// source = side: count, interval S as float bits, accumulated ticks
+	FR_BATTERY,			// battery mV
+	FR_MOTOR_MODE,		// DC2 modes: left, right
+	FR_MOTOR_POWER,		// DC2 powers in 1/100 %: left, right
+	FR_SPEED_ERROR,		// source = side: velocity error in 1/1000 ticks/S, power adjustment in 1/100 %
+	FR_STATE,			// source = controller: old state, new state
+	FR_SHUTDOWN,		// a shutdown request: error
+	FR_NUM_TYPES
+};
+
+// controllers, the source of FR_STATE records
+enum RECORD_SOURCE {FR_ROAM = 0, FR_GOTO_OBJECT};
+
+struct FlightRecord
+{
+	uint64_t time_us;			// MonotonicTime_us()
+	uint16_t type;
+	uint16_t source;
+	int32_t values[3];
+};
+
+struct FlightRecorderHeader
+{
+	const static unsigned Version = 3;
+
+	char magic[8];				// "JEFEFDR"
+	uint32_t version;
+	uint32_t recordSize;
+	uint64_t capacity;			// records, a power of 2
+	uint64_t startTime_us;
+	std::atomic<uint64_t> head;	// records ever written
+	uint8_t reserved[24];
+
+	// check that a mapped file of the given size is a ring this code can read
+	bool IsValid(size_t fileSize) const
+	{
+		return (
+			fileSize >= sizeof(FlightRecorderHeader) &&
+			memcmp(magic, "JEFEFDR", 8) == 0 &&
+			version == Version &&
+			recordSize == sizeof(FlightRecord) &&
+			sizeof(FlightRecorderHeader) + capacity * sizeof(FlightRecord) <= fileSize
+		);
+	}
+};
+
+static_assert(sizeof(FlightRecord) == 24, "flight record layout changed");
+static_assert(sizeof(FlightRecorderHeader) == 64, "flight recorder header layout changed");
+
+class FlightRecorder
+{
+private:
+	FlightRecorderHeader* header;
+	FlightRecord* records;
+	uint64_t mask;
+	size_t length;
+
+	void Record(RECORD_TYPE type, unsigned source, int32_t v0, int32_t v1 = 0, int32_t v2 = 0);
+
+public:
+	// 1.5 MB, several minutes of a mission
+	const static unsigned DefaultCapacity = 1 << 16;
+
+	FlightRecorder();
+	~FlightRecorder();
+
+	void Open(const char* path, unsigned capacity = DefaultCapacity);
+	void Close();
+	bool IsOpen() const
+	{
+		return records != 0;
+	}
+
+	void Edges(const unsigned edge_mV[3])
+	{
+		if (records)
+			Record(FR_EDGES, 0, edge_mV[0], edge_mV[1], edge_mV[2]);
+	}
+	void Range(unsigned sensor, unsigned distance)
+	{
+		if (records)
+			Record(FR_RANGE, sensor, distance);
+	}
+	// the interval is kept bit for bit so that a replay sees exactly the same speeds
+	void Odometry(unsigned side, unsigned count, float interval, int ticks)
+	{
+		int32_t bits;
+
+		if (records)
+		{
+			memcpy(&bits, &interval, sizeof(bits));
+			Record(FR_ODOMETRY, side, count, bits, ticks);
+		}
+	}
+	void Battery(float voltage)
+	{
+		if (records)
+			Record(FR_BATTERY, 0, (int32_t)(voltage * 1000));
+	}
+	void MotorMode(char modeL, char modeR)
+	{
+		if (records)
+			Record(FR_MOTOR_MODE, 0, modeL, modeR);
+	}
+	void MotorPower(float powerL, float powerR)
+	{
+		if (records)
+			Record(FR_MOTOR_POWER, 0, (int32_t)(powerL * 100), (int32_t)(powerR * 100));
+	}
+	void SpeedError(unsigned side, float error, float adjustment)
+	{
+		if (records)
+			Record(FR_SPEED_ERROR, side, (int32_t)(error * 1000), (int32_t)(adjustment * 100));
+	}
+	void StateChanged(RECORD_SOURCE controller, int oldState, int newState)
+	{
+		if (records)
+			Record(FR_STATE, controller, oldState, newState);
+	}
+	void Shutdown(int error)
+	{
+		if (records)
+			Record(FR_SHUTDOWN, 0, error);
+	}
+};
+
+extern FlightRecorder flightRecorder;
+
+#endif /* INCLUDE_FLIGHT_RECORDER_H_ */
@@ -15,19 +15,99 @@
 
 #include "controller.h"
 
-class GotoObjectController : public Controller
+class GotoObjectController : public Controller, public Locomotive::MotionHandler
 {
 private:
-	enum STATE {ESTABLISH_RANGE, FIND_OBJECT, ROTATE_TO_OBJECT, MEASURE_OBJECT, MOVE_TO_OBJECT, ADJUST_POSITION, GOTO_OBJECT, PUSH_OBJECT, AVOID_EDGE, PREVENT_FALLING, COMPLETE} state;
+	// range profile of a scan, one sample per new range reading
+	const static unsigned MaxScanSamples = 256;
+	// how much farther than the nearest reading still counts as the object, in mm
+	const static unsigned ObjectDepth = 30;
+	// how far to back up once the object is pushed off, in cm
+	const static unsigned BackUpDistance = 6;
+	struct ScanSample
+	{
+		float heading;
+		unsigned distance;
+	};
+
+	enum STATE
+	{
+		ESTABLISH_RANGE, TURN_TO_OBJECT, GOTO_OBJECT, PUSH_OBJECT, AVOID_EDGE, PREVENT_FALLING, COMPLETE,
+		NUM_STATES
+	};
 	unsigned objDistance;
+	ScanSample scan[MaxScanSamples];
+	unsigned numScanSamples;
+	uint64_t lastRangeTimes_us[MultiPingRangeSensor::MaxSensors];
+	uint64_t lastOdometryTime_us;
+	float lastHeading;
+
+	bool LocateObject(float* pHeading);
+
+	// state actions
+	void StartScan();
+	void Scan();
+	void TurnToObject();
+	void GotoObject();
+	void PushObject();
+	void AvoidEdge();
+	void PreventFalling();
+	void BackUp();
+	void Complete();
+
+	typedef StateRow<GotoObjectController, STATE> Row;
+	constexpr static Row States[NUM_STATES] =
+	{
+		{
+			ESTABLISH_RANGE, "ESTABLISH_RANGE", &GotoObjectController::StartScan, &GotoObjectController::Scan,
+			StateSet(TURN_TO_OBJECT)
+		},
+		{
+			TURN_TO_OBJECT, "TURN_TO_OBJECT", &GotoObjectController::TurnToObject, 0,
+			StateSet(GOTO_OBJECT)
+		},
+		{
+			GOTO_OBJECT, "GOTO_OBJECT", 0, &GotoObjectController::GotoObject,
+			StateSet(PUSH_OBJECT, ESTABLISH_RANGE, AVOID_EDGE)
+		},
+		{
+			PUSH_OBJECT, "PUSH_OBJECT", 0, &GotoObjectController::PushObject,
+			StateSet(PREVENT_FALLING, AVOID_EDGE)
+		},
+		{
+			AVOID_EDGE, "AVOID_EDGE", &GotoObjectController::AvoidEdge, 0,
+			StateSet()
+		},
+		{
+			PREVENT_FALLING, "PREVENT_FALLING", &GotoObjectController::BackUp, &GotoObjectController::PreventFalling,
+			StateSet(COMPLETE)
+		},
+		{
+			COMPLETE, "COMPLETE", &GotoObjectController::Complete, 0,
+			StateSet()
+		}
+	};
+	StateMachine<GotoObjectController, STATE, NUM_STATES, States, ControllerTracer, StateTimes<NUM_STATES>> machine;
 
 protected:
 	void Routine();
 
+	// a scan or the turn to the object is complete
+	void OnMotionComplete();
+
 public:
 	GotoObjectController(Context& ctx, bool isVerbose);
 	~GotoObjectController()
 	{}
+
+	const char* StateName() const
+	{
+		return machine.Name();
+	}
+	void PrintStateTimes(FILE* fp) const
+	{
+		machine.PrintTimes(fp);
+	}
 };
 
 #endif /* INCLUDE_GOTO_OBJECT_CONTROLLER_H_ */
@@ -0,0 +1,102 @@
+/*
+ *  latency.h
+ *
+ *  Description: Hot path latency instrumentation for the edge to stop path, the metric
+ *  that decides whether jefebot falls off the table.  Three points are timestamped:
+ *      1. sampled:  an ADC812 sample arrives in which an edge sensor crosses its limit
+ *      2. decided:  a controller decides from AtAnyEdge() that it is at an edge
+ *      3. stopped:  Locomotive writes BREAK to both motors
+ *  and the latency of each stage is kept in a log-linear histogram.
+ *
+ *  Interface:
+ *    - LatencyHistogram: fixed size log-linear histogram of microsecond latencies
+ *    - EdgeLatencyProbe: the edge to stop probe, there is a single instance, edgeLatency
+ */
+
+#ifndef INCLUDE_LATENCY_H_
+#define INCLUDE_LATENCY_H_
+
+#include <stdint.h>
+#include <cstdio>
+#include <atomic>
+
+/*
+ * 8 linear buckets per power of 2 above 16, exact below, so the relative error of any
+ * bucket is at most 12.5%; recording is a few shifts and an increment.  Values are in
+ * whatever unit the caller records, uS for the edge latency.
+ */
+class LatencyHistogram
+{
+private:
+	const static unsigned LinearLimit = 16;
+	const static unsigned SubBuckets = 8;
+	const static unsigned NumBuckets = LinearLimit + SubBuckets * (32 - 4);
+
+	unsigned counts[NumBuckets];
+	unsigned long total;
+	uint64_t sum;
+	uint64_t min;
+	uint64_t max;
+
+	static unsigned BucketOf(uint64_t value);
+	static uint64_t BucketLow(unsigned bucket);
+
+public:
+	LatencyHistogram();
+	void Record(uint64_t value);
+	void Clear();
+	unsigned long Count() const
+	{
+		return total;
+	}
+	uint64_t Min() const
+	{
+		return total ? min : 0;
+	}
+	uint64_t Max() const
+	{
+		return max;
+	}
+	uint64_t Mean() const
+	{
+		return total ? sum / total : 0;
+	}
+
+	// the high end of the bucket holding the given fraction of the values, within the
+	// recorded min and max, so a percentile never understates a latency
+	uint64_t Percentile(double fraction) const;
+	void Print(FILE* fp, const char* name) const;
+};
+
+// the samples are seen on the acquisition thread, the decision and stop may be made on the
+// control thread, see pipeline.h
+class EdgeLatencyProbe
+{
+private:
+	enum STAGE {IDLE, SAMPLED, DECIDED};
+	std::atomic<STAGE> stage;
+	uint64_t sampleTime_us;
+	std::atomic<uint64_t> decisionTime_us;
+	LatencyHistogram sampleToDecision;
+	LatencyHistogram decisionToStop;
+	LatencyHistogram sampleToStop;
+
+public:
+	EdgeLatencyProbe();
+
+	// called by EdgeDetector as samples arrive
+	void EdgeSampled();
+	void EdgeCleared();
+
+	// called by a controller when it acts on AtAnyEdge()
+	void EdgeDecided();
+
+	// called by Locomotive when it writes BREAK to both motors
+	void Stopped();
+
+	void Print(FILE* fp) const;
+};
+
+extern EdgeLatencyProbe edgeLatency;
+
+#endif /* INCLUDE_LATENCY_H_ */
@@ -0,0 +1,87 @@
+/*
+ *  logger.h
+ *
+ *  Description: Logging off the control path.  Once started, Print() formats a line into
+ *  a fixed size record and pushes it into its thread's SpscRing, and a worker thread
+ *  writes the lines out, at the lowest priority under the normal scheduler whatever
+ *  thread started it; so a slow terminal, e.g. the Pi's serial console, delays only the
+ *  worker, never the thread that logged.  A line is never waited for: if
+ *  its ring is full it is dropped and counted, and one longer than MaxLine is cut short.
+ *
+ *  Each thread gets a ring of its own the first time it logs, up to MaxThreads; the lines
+ *  of one thread are written in order, those of different threads may interleave.  When
+ *  the logger is not started, or a thread finds no ring left, Print() writes the line
+ *  itself, as printf would.
+ *
+ *  Interface:
+ *    - SetFile(): where the lines go, stdout by default
+ *    - Start(): start the worker thread; Stop(): let it write the queued lines, then join it
+ *    - Print(): log a line, printf style
+ *    - GetNumDropped(): how many lines were dropped
+ *  There is a single instance, logger.
+ */
+
+#ifndef INCLUDE_LOGGER_H_
+#define INCLUDE_LOGGER_H_
+
+#include <cstdio>
+#include <atomic>
+#include <thread>
+#include <semaphore.h>
+#include "spsc_ring.h"
+
+class Logger
+{
+public:
+	const static unsigned MaxLine = 120;
+	const static unsigned MaxThreads = 4;
+	// nice value of the worker, the lowest there is
+	const static int WorkerNice = 19;
+
+private:
+	const static unsigned QueueSize = 64;
+
+	struct Line
+	{
+		unsigned length;
+		char text[MaxLine];
+	};
+
+	FILE* fp;
+	std::thread worker;
+	sem_t pending;
+	std::atomic<bool> isStarted;
+	bool isStopping;
+	SpscRing<Line, QueueSize> rings[MaxThreads];
+	std::atomic<unsigned> numRings;			// claimed by a thread
+	std::atomic<unsigned long> numDropped;
+
+	int ClaimRing();
+	void Work();
+
+public:
+	Logger();
+	~Logger();
+
+	void SetFile(FILE* _fp)
+	{
+		fp = _fp;
+	}
+	void Start();
+	void Stop();
+	bool IsStarted() const
+	{
+		return isStarted.load(std::memory_order_acquire);
+	}
+
+	void Print(const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+	unsigned long GetNumDropped() const
+	{
+		return numDropped.load(std::memory_order_relaxed);
+	}
+};
+
+extern Logger logger;
+
+#endif /* INCLUDE_LOGGER_H_ */
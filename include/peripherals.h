@@ -13,12 +13,18 @@
 #ifndef PERIPHERALS_H_
 #define PERIPHERALS_H_
 
+#include <cstdio>
+#include <cmath>
+#include <atomic>
 #include <dp_adc812.h>
 #include <dp_bb4io.h>
 #include <dp_count4.h>
 #include <dp_dc2.h>
 #include <dp_ping4.h>
 #include "adc.h"
+#include "sensor_frame.h"
+#include "sharp_gp2y0a21.h"
+#include "battery.h"
 
 // DP peripheral list -- this must agree with the output of dplist
 #define BB4IO_IDX	"1"		// The buttons and LEDs on the Baseboard
@@ -32,11 +38,16 @@
 #define TIF_IDX		"9"   	// Text Interface
 #define PING4_IDX 	"10"  	// Quad interface to a Parallax Ping)))
 
+class ControlPipeline;
+
 /*
  * class to control the LEDs and buttons on the BBIO4 board
  */
 class UserInterface : public DP::BB4IO
 {
+protected:
+	void Handler();
+
 public:
 	enum BUTTONS {BUTTON1 = S1, BUTTON2 = S2, BUTTON3 = S3};
 
@@ -53,31 +64,96 @@ public:
 
 /*
  * combo class to implement a dual motor controller and accept the ticks returned
- * from each motor to keep track of the current position of the bot
+ * from each motor to keep track of the current position of the bot; whenever the bot
+ * is moving or spinning, each motor's power is regulated by its own velocity PID so
+ * that both wheels turn at the same speed and the bot holds its heading; a sequence of
+ * motions can be submitted at once and is run back to back from the encoder updates
+ *
+ * With a control pipeline the handler only decodes the encoder update, and all the rest
+ * is done by Update() when the pipeline runs it, which may be on the control thread; the
+ * motor settings and the stop flags can then be read from any thread
  */
 class Locomotive : public DP::COUNT4, public DP::DC2
 {
+public:
+	// a segment of a motion sequence, amount is in cm or radians, 0 to run until cancelled
+	enum MOTION {MOTION_FORWARD, MOTION_REVERSE, MOTION_SPIN_CW, MOTION_SPIN_CCW};
+	struct MotionSegment
+	{
+		enum MOTION motion;
+		float amount;
+	};
+
+	// interface of an object to be notified when a motion sequence is complete
+	class MotionHandler
+	{
+	public:
+		virtual ~MotionHandler()
+		{}
+		virtual void OnMotionComplete() = 0;
+	};
+
 private:
 	const static unsigned Count4Period = 50;
 	const static unsigned WatchdogTimeout = 0;
-	const static float MinSpeed = 20.0;
-	const static float MaxSpeed = 100.0;
-	const static float MaxVelocityErr = 5.0;
+	constexpr static float MinSpeed = 20.0;
+	constexpr static float MaxSpeed = 100.0;
 	const static unsigned TicksPerCM = 2;
 	const static unsigned TicksPerRadian = 14;
+	const static unsigned MaxMotionSegments = 8;
+	// spinning in place each wheel rolls WheelBase/2 cm per radian
+	constexpr static float WheelBase = 2.0 * TicksPerRadian / TicksPerCM;
+	// variance in cm^2 of each wheel's travel per cm rolled, for the pose covariance
+	constexpr static float WheelVariance = 0.05;
 
+	// velocity PID gains, the error is in ticks/S and the output in % power
+	constexpr static float Kp = 0.4;
+	constexpr static float Ki = 1.5;
+	constexpr static float Kd = 0.01;
+	// time constant of the derivative's low pass filter in S
+	constexpr static float DerivativeFilterTau = 0.1;
 
-    // TODO: tweak, tweak, tweak !!!
-	// PID controller gains
-	const static float Kp = 0.02;
-	const static float Ki = 0.0;
-	const static float Kd = 0.0;
+	// per motor PID state
+	struct SpeedRegulator
+	{
+		float integral;			// % power
+		float derivative;		// filtered rate of change of the velocity, ticks/S^2
+		float prevVelocity;
+		bool isPrimed;			// prevVelocity is valid
+	};
 
 	enum DIRECTION {STOP, MOVE_FORWARD, MOVE_REVERSE, SPIN_CW, SPIN_CCW} direction;
 	float defaultSpeed;
 	int ticks[2];			// total accumulated count -- must be signed, +/- -> fwd/rev
-	char modes[2];
-	float powers[2];
+	std::atomic<char> modes[2];
+	std::atomic<float> powers[2];
+	SpeedRegulator regulators[2];
+	Pose pose;
+	bool isMoving;			// HasMovedDistance() is measuring, from moveBegin
+	float moveBegin;
+	bool isTurning;			// HasTurnedAngle() is measuring, from turnBegin
+	float turnBegin;
+	MotionSegment motionSegments[MaxMotionSegments];
+	unsigned numMotionSegments;
+	unsigned motionSegment;	// the one running, numMotionSegments when idle
+	float segmentBegin;		// odometer or rotation when it started
+	float segmentProgress;	// odometer or rotation at the last update
+	MotionHandler* motionHandler;
+	std::atomic<bool> isHaltRequested;	// by RequestHalt(), from another thread
+	std::atomic<bool> isHalted;			// EmergencyStop() has latched the motors in BREAK
+	std::atomic<uint64_t> haltTime_ns;	// Profiler::Now_ns() once the latching BREAKs were written
+	std::atomic<bool> isStopConfirmed;	// an encoder update since has shown both wheels standing still
+	SensorFrameBuffer& sensors;
+	ControlPipeline* pipeline;
+
+	void PublishOdometry(const unsigned counts[2], const float intervals[2]);
+	void UpdatePose(int deltaL, int deltaR);
+	void SetDirection(enum DIRECTION newDirection, char modeL, char modeR);
+	void ResetRegulators();
+	float GetVelocity(unsigned count, float interval);
+	float Regulate(int side, float target, float velocity);
+	void StartMotionSegment();
+	void RunMotion();
 
 protected:
 	void Handler();
@@ -85,7 +161,7 @@ protected:
 public:
 	enum SIDE {LEFT = 0, RIGHT};
 
-	Locomotive(DP::EventContext& evtCtx, float defaultSpeed);
+	Locomotive(DP::EventContext& evtCtx, SensorFrameBuffer& sensors, float defaultSpeed);
 	~Locomotive()
 	{
 		//delete motors;
@@ -111,6 +187,22 @@ public:
 	
 	// clear all motor ticks
 	void ClearTicks();
+
+	// hand the encoder updates to a pipeline, 0 to handle them at once
+	void SetPipeline(ControlPipeline* _pipeline)
+	{
+		pipeline = _pipeline;
+	}
+	// dead reckon, run the motion and regulate the speed from an encoder update
+	void Update(const unsigned counts[2], const float intervals[2]);
+
+	// the latest pose, safe to call from any thread
+	void GetPose(Pose* pPose) const
+	{
+		SensorFrame frame;
+		sensors.Read(&frame);
+		*pPose = frame.pose;
+	}
 	
 	// set the mode, power of the motors
 	void SetMode(char modeL, char modeR);
@@ -118,6 +210,33 @@ public:
 	
 	// halt the movement of the motors
 	void Stop();
+
+	// BREAK both motors ahead of anything else, the bound on its latency is 2 DC2 writes,
+	// then ignore every later motor command; the stop is confirmed once an encoder update
+	// shows both wheels standing still
+	void EmergencyStop();
+	// have the thread that commands the motors make the emergency stop, before its next
+	// motor command or at its next CheckHalt(); the DC2 keeps a single writer
+	void RequestHalt()
+	{
+		isHaltRequested.store(true, std::memory_order_release);
+	}
+	// from the thread that commands the motors: make a requested emergency stop, true
+	// once the motors are halted
+	bool CheckHalt();
+	bool IsHalted() const
+	{
+		return isHalted;
+	}
+	// when the motors were latched in BREAK, valid once IsHalted()
+	uint64_t GetHaltTime_ns() const
+	{
+		return haltTime_ns;
+	}
+	bool IsStopConfirmed() const
+	{
+		return isStopConfirmed;
+	}
 	
 	// describe which direction to move, this is used in conjunction with the
 	// HasMovedDistance() function to perform a linear movement
@@ -134,24 +253,76 @@ public:
 	
 	// flag to signify that the requested angle turned has been achieved
 	bool HasTurnedAngle(float angleInRadians, float* curAngle = 0);
+
+	// start a sequence of motions, replacing any in progress, which runs without stopping
+	// between segments; the handler is notified once the last segment is complete, or for
+	// an open ended last segment once it has started, and the bot is stopped if the last
+	// segment ends; Stop() or any single movement above cancels the sequence
+	void Submit(const MotionSegment* segments, unsigned count, MotionHandler* handler = 0);
+	void CancelMotion();
+	bool IsMotionPending() const
+	{
+		return motionSegment < numMotionSegments;
+	}
 };
 
 /*
- *  The RangeSensor class is based on a DP_Ping4 peripheral with a single sensor, SENSOR_0.
+ *  The MultiPingRangeSensor class drives up to 4 Ping))) sensors on a DP_Ping4 peripheral,
+ *  each mounted at its own angle.  Sensors whose cones could hear each other's echoes never
+ *  fire together: they are split into firing slots of sensors at least MinSeparation apart
+ *  and each PING4 update fires the next slot.  Every reading is published to the sensor
+ *  frame; the first sensor is the nose sensor, whose reading is also the frame's distance.
  */
-class SinglePingRangeSensor : public DP::PING4
+class MultiPingRangeSensor : public DP::PING4
 {
+public:
+	const static unsigned MaxSensors = 4;
+
+	struct Mount
+	{
+		enum SENSORS sensor;
+		float angle;		// radians CCW from the nose
+	};
+
 private:
+	constexpr static float MinSeparation = 1.5708;
+	Mount mounts[MaxSensors];
+	unsigned numSensors;
+	unsigned slots[MaxSensors];		// masks of the sensors fired together
+	unsigned numSlots;
+	unsigned slot;					// the one firing
 	unsigned innerLimit;
 	unsigned outerLimit;
+	SensorFrameBuffer& sensors;
+
+	void Fire(unsigned nextSlot);
+
+protected:
+	void Handler();
 
 public:
-	SinglePingRangeSensor(DP::EventContext& evtCtx, int _innerLimit, int _outerLimit);
-	
-	// get the currently sensed distance
+	MultiPingRangeSensor(
+		DP::EventContext& evtCtx,
+		SensorFrameBuffer& sensors,
+		const Mount* mounts,
+		unsigned numSensors,
+		int _innerLimit,
+		int _outerLimit
+	);
+
+	unsigned GetNumSensors() const
+	{
+		return numSensors;
+	}
+	const Mount& GetMount(unsigned index) const
+	{
+		return mounts[index];
+	}
+
+	// get the currently sensed distance of the nose sensor
 	unsigned GetDistance()
 	{
-		return DP::PING4::GetDistance(SENSOR_0);
+		return DP::PING4::GetDistance(mounts[0].sensor);
 	}
 	
 	// flag to signify that the bot is next to an object
@@ -159,7 +330,17 @@ public:
 	{
 	    return (GetDistance() < innerLimit);
 	}
+	bool AtObject(const SensorFrame& frame)
+	{
+	    return (frame.rangeTime_us != 0 && frame.distance < innerLimit);
+	}
 	
+	// flag to signify that a distance is within the bounds objects are looked for in
+	bool IsWithinBounds(unsigned distance)
+	{
+		return (distance < outerLimit);
+	}
+
 	// return the distance from an object within a given limit
 	bool DetectObject(unsigned limit, unsigned* pDistance)
 	{
@@ -169,51 +350,203 @@ public:
 		}
 	    return ((*pDistance = GetDistance()) < limit);
 	}
+	bool DetectObject(const SensorFrame& frame, unsigned limit, unsigned* pDistance)
+	{
+		if (limit == 0)
+		{
+			limit = outerLimit;
+		}
+	    *pDistance = frame.distance;
+	    return (frame.rangeTime_us != 0 && *pDistance < limit);
+	}
+
+	// the nearest reading in a frame of the sensors mounted within maxAngle of the nose, and
+	// the angle it was seen at, false if none of them has been read yet
+	bool GetNearest(const SensorFrame& frame, float maxAngle, unsigned* pDistance, float* pAngle = 0) const;
+
+	// flag to signify that any sensor looking ahead of the bot is next to an object
+	bool AtAnyObject(const SensorFrame& frame, float* pAngle = 0) const
+	{
+		unsigned distance;
+		return (GetNearest(frame, MinSeparation, &distance, pAngle) && distance < innerLimit);
+	}
+
+	// how far the bot has to spin for the sensors together to have looked every way
+	float GetScanAngle() const;
 };
 
 /*
- * combination 3-edge detector based on 3 Sharp GP2Y0A21YK0F distance sensors
+ *  The SinglePingRangeSensor class is the special case of a single sensor, SENSOR_0, on the nose.
+ */
+class SinglePingRangeSensor : public MultiPingRangeSensor
+{
+private:
+	const static Mount Nose;
+
+public:
+	SinglePingRangeSensor(DP::EventContext& evtCtx, SensorFrameBuffer& sensors, int _innerLimit, int _outerLimit) :
+		MultiPingRangeSensor(evtCtx, sensors, &Nose, 1, _innerLimit, _outerLimit)
+	{}
+};
+
+/*
+ * combination 3-edge detector based on 3 Sharp GP2Y0A21YK0F distance sensors; an edge
+ * handler can be registered to be called as soon as the filtered samples cross an edge limit
+ *
+ * Each channel is filtered by the median of its last MedianLength samples, so a single
+ * glitch never stops the bot, and an edge has hysteresis: it is entered below the edge
+ * limit and only left above the clear limit.  The sensors are sampled every 25 mS, twice
+ * as often as they used to be, so that the median costs no more latency than the single
+ * sample it replaces.
+ *
+ * For its first CalibrationSamples samples the detector calibrates: it learns each
+ * sensor's baseline, its reading on the table surface, and its noise, while detecting
+ * edges at the nominal limit.  Then each sensor gets its own limits: the edge limit
+ * EdgeMarginSigmas standard deviations, but at least MinEdgeMargin of the baseline, from
+ * the baseline towards the nominal limit, and never beyond it.  A sensor whose baseline
+ * is too near the nominal limit to calibrate keeps it.
+ *
+ * The readings and limits are the sensor voltages in mV, where an edge reads lower than
+ * the surface, or with USE_DISTANCE_NOT_VOLTAGE the distances in cm that the Sharp
+ * curve converts them to, where an edge reads farther.  Either way the median is taken
+ * of the voltages, as the conversion preserves their order.
  */
 class EdgeDetector : public DP::ADC812
 {
+public:
+	class EdgeHandler;
+
 private:
-	const static unsigned Period = 50;
-	unsigned edgeLimits[3];
+	const static unsigned Period = 25;
+	const static unsigned MedianLength = 3;
+	const static unsigned CalibrationSamples = 20;
+	constexpr static float EdgeMarginSigmas = 8.0;
+	constexpr static float MinEdgeMargin = 0.25;
+	constexpr static float HysteresisSigmas = 3.0;
+#ifdef USE_DISTANCE_NOT_VOLTAGE
+	const static unsigned MinHysteresis = 2;
+#else
+	const static unsigned MinHysteresis = 30;
+#endif
+	constexpr static SharpDistanceTable DistanceTable = SharpDistanceTable();
+
+	// a sensor's filter and limits
+	struct Channel
+	{
+		unsigned history[MedianLength];
+		unsigned edgeLimit;
+		unsigned clearLimit;
+		bool isAtEdge;
+
+		// calibration: the count, mean and sum of squared deviations of the surface samples
+		unsigned numSamples;
+		float mean;
+		float m2;
+	};
+
+	unsigned nominalEdgeLimit;
+	Channel channels[3];
+	unsigned numSamples;
+	SensorFrameBuffer& sensors;
+	EdgeHandler* edgeHandler;
+
+	unsigned Filter(Channel& channel, unsigned sample);
+	void Calibrate(Channel& channel, unsigned sample_mV);
+	void EndCalibration(Channel& channel);
+
+protected:
+	void Handler();
 
 public:
 #ifdef USE_DISTANCE_NOT_VOLTAGE
 	const static unsigned MinEdgeRange = 10;
-	const static unsigned MaxEdgeRange = 80;
+	const static unsigned MaxEdgeRange = SharpDistanceTable::MaxDistance_cm;
 #else
-	// TODO: use actual sensor min and max values
 	const static unsigned MinEdgeRange = 0;
-	const static unsigned MaxEdgeRange = 5000;
+	const static unsigned MaxEdgeRange = SharpDistanceTable::FullScale_mV;
 #endif
 	enum EDGE_SENSORS {LEFT = CHANNEL_1, FRONT = CHANNEL_2, RIGHT = CHANNEL_3};
 
-	EdgeDetector(DP::EventContext& evtCtx, unsigned nominalEdgeLimit);
+	// interface of an object to be notified the moment a new sample crosses an edge limit
+	class EdgeHandler
+	{
+	public:
+		virtual ~EdgeHandler()
+		{}
+		virtual void OnEdge(enum EDGE_SENSORS edge) = 0;
+	};
+
+	EdgeDetector(DP::EventContext& evtCtx, SensorFrameBuffer& sensors, unsigned nominalEdgeLimit);
+
+	// set the handler to be called on an edge crossing, 0 for none
+	void SetEdgeHandler(EdgeHandler* handler)
+	{
+		edgeHandler = handler;
+	}
+
+	bool IsCalibrated() const
+	{
+		return numSamples >= CalibrationSamples;
+	}
+	// the learned surface reading and its standard deviation, once calibrated
+	float GetBaseline(EDGE_SENSORS sensorId) const
+	{
+		return channels[sensorId].mean;
+	}
+	float GetNoise(EDGE_SENSORS sensorId) const
+	{
+		const Channel& channel = channels[sensorId];
+		return (channel.numSamples > 1) ? sqrtf(channel.m2 / (channel.numSamples - 1)) : 0.0;
+	}
+	unsigned GetEdgeLimit(EDGE_SENSORS sensorId) const
+	{
+		return channels[sensorId].edgeLimit;
+	}
+	void PrintCalibration(FILE* fp) const;
 	
-	// flag to signify that some edge has been detected
+	// flag to signify that some edge has been detected, either now or in a sensor frame
 	bool AtAnyEdge(enum EDGE_SENSORS* pEdge = 0);
-	// TODO: change from using voltage to distance for values and limits
-	
-#ifdef USE_DISTANCE_NOT_VOLTAGE
-    // flag to signify that a specific edge has been detected
+	bool AtAnyEdge(const SensorFrame& frame, enum EDGE_SENSORS* pEdge = 0);
+
+    // flag to signify that a specific edge has been detected, after filtering
 	bool AtEdge(enum EDGE_SENSORS sensorId)
 	{
-	    return (GetEdgeSensorDistance_cm(sensorId) < edgeLimits[sensorId]);
+	    return channels[sensorId].isAtEdge;
+	}
+
+	// the distance a sample reads, a single lookup in the Sharp curve
+	static unsigned ToDistance_cm(unsigned sample_mV)
+	{
+		return DistanceTable.ToDistance_cm(sample_mV);
 	}
-	
 	// return the sensed distance of an edge detector
 	unsigned GetEdgeSensorDistance_cm(EDGE_SENSORS sensorId)
 	{
-		// from the Sharp GP2Y0A21YK0F datasheet
-		return (27 / (GetSample_mV(sensorId) / 1000));
+		return ToDistance_cm(GetSample_mV(sensorId));
+	}
+	
+#ifdef USE_DISTANCE_NOT_VOLTAGE
+	bool IsEdgeSample(enum EDGE_SENSORS sensorId, unsigned sample_mV)
+	{
+	    return (ToDistance_cm(sample_mV) > channels[sensorId].edgeLimit);
+	}
+	bool IsClearSample(enum EDGE_SENSORS sensorId, unsigned sample_mV)
+	{
+	    return (ToDistance_cm(sample_mV) <= channels[sensorId].clearLimit);
+	}
+	unsigned GetEdgeSensorValue(EDGE_SENSORS sensorId)
+	{
+		// return the sensor distance in cm
+		return GetEdgeSensorDistance_cm(sensorId);
 	}
 #else
-	bool AtEdge(enum EDGE_SENSORS sensorId)
+	bool IsEdgeSample(enum EDGE_SENSORS sensorId, unsigned sample_mV)
+	{
+	    return (sample_mV < channels[sensorId].edgeLimit);
+	}
+	bool IsClearSample(enum EDGE_SENSORS sensorId, unsigned sample_mV)
 	{
-	    return (GetSample_mV(sensorId) < edgeLimits[sensorId]);
+	    return (sample_mV >= channels[sensorId].clearLimit);
 	}
 	unsigned GetEdgeSensorValue(EDGE_SENSORS sensorId)
 	{
@@ -224,14 +557,52 @@ public:
 };
 
 /*
- * a volt meter class implemented with an ADC being handled at 50mS
+ * a volt meter class implemented with an ADC being handled at 50mS, only the channels
+ * subscribed to are sampled; the battery, on battChannel behind a battDivider:1 divider,
+ * is sampled at the period its estimator asks for, the load on it taken from the motors
+ * of the locomotive, if any, and it is published to the sensor frame whenever it is sampled
  */
 class VoltMeter : public ADC
 {
+private:
+	const static unsigned Period = 50;
+	SensorFrameBuffer& sensors;
+	unsigned battChannel;
+	float battDivider;
+	unsigned battSamples;
+	BatteryEstimator battery;
+	Locomotive* locomotive;
+
+protected:
+	void Routine();
+
 public:
-	VoltMeter(DP::EventContext& evtCtx) : ADC(50)
+	VoltMeter(
+		DP::EventContext& evtCtx,
+		SensorFrameBuffer& _sensors,
+		unsigned _battChannel,
+		float _battDivider,
+		const BatteryEstimator::Pack& pack
+	) :
+		ADC(Period), sensors(_sensors), battChannel(_battChannel), battDivider(_battDivider), battSamples(0),
+		battery(pack), locomotive(0)
 	{
 		evtCtx.Register(this);
+		Subscribe(battChannel, battery.GetSamplePeriod());
+	}
+	float GetBatteryVoltage()
+	{
+		return battDivider * GetVoltage(battChannel);
+	}
+	const BatteryEstimator& GetBattery() const
+	{
+		return battery;
+	}
+
+	// the motors that load the battery
+	void SetLocomotive(Locomotive* _locomotive)
+	{
+		locomotive = _locomotive;
 	}
 };
 
@@ -0,0 +1,135 @@
+/*
+ *  pipeline.h
+ *
+ *  Description: The path from jefebot's sensors to its motors, split between an
+ *  acquisition thread and a control thread.  The acquisition thread is the one running
+ *  the DP event loop: it reads dpserver's packets and the peripherals decode them,
+ *  filter them and publish them to the sensor frame, as they always have.  What the
+ *  control program does with a packet, though, it only posts as an Event:
+ *      - ODOMETRY: a Count4 update, for Locomotive's dead reckoning, motions and PIDs
+ *      - EDGE:     a new edge, for the controller to act on now
+ *      - TICK:     the controller's period has elapsed
+ *      - STOP:     an emergency stop, from a shutdown on the acquisition thread
+ *  and the control thread runs the Locomotive and the controller on it.  The events go
+ *  through an SpscRing, so posting one takes no lock and only a sem_post() to wake the
+ *  control thread; a packet never waits for the control work of the one before it, nor
+ *  the control work for a slow printf, which goes to the Logger's own thread.
+ *
+ *  Threaded, the control thread is the only one that commands the motors: a shutdown
+ *  elsewhere has it make the emergency stop, at the cost of a wake up.  The sensor frame
+ *  is published from both threads.
+ *
+ *  Should the control thread fall so far behind that the ring is full, no event that
+ *  matters is lost: an odometry update is held back, adding up the counts and intervals
+ *  of any that follow it, and an edge is held back too, both to go ahead of the next
+ *  event posted; a stop is requested of the Locomotive, which the control thread makes
+ *  ahead of its next motor command or event, so the motors still have the one writer;
+ *  only a tick is dropped, the controller has another a period later.
+ *
+ *  Not started, the pipeline runs each event on the acquisition thread as it is posted,
+ *  which is the single event loop jefebot always had.  Either way it measures the
+ *  latency of each event type, from PacketArrival_ns() of the packet or timer that
+ *  caused it to the end of its control work, any motor commands included.
+ *
+ *  Interface:
+ *    - SetController(): the controller to run; the pipeline takes its place as the edge
+ *      detector's handler and as the callback registered with the event loop
+ *    - Start(): start the control thread; Stop(): let it run the queued events, then join
+ *      it, unless it is stuck
+ *    - Odometry(), OnEdge(), Routine(): post the events, from the acquisition thread
+ *    - EmergencyStop(): stop the motors from any thread
+ *    - GetLatencies(), Print(): the latencies
+ */
+
+#ifndef INCLUDE_PIPELINE_H_
+#define INCLUDE_PIPELINE_H_
+
+#include <stdint.h>
+#include <cstdio>
+#include <atomic>
+#include <thread>
+#include <semaphore.h>
+#include "controller.h"
+#include "latency.h"
+#include "spsc_ring.h"
+
+class ControlPipeline : public DP::Callback, public EdgeDetector::EdgeHandler
+{
+public:
+	struct Event
+	{
+		enum TYPE {ODOMETRY, EDGE, TICK, STOP, NUM_TYPES} type;
+		uint64_t arrival_ns;		// PacketArrival_ns()
+		unsigned edge;				// EDGE: the EdgeDetector::EDGE_SENSORS
+		unsigned counts[2];			// ODOMETRY: the Count4 update, by Locomotive::SIDE
+		float intervals[2];
+	};
+
+private:
+	const static unsigned QueueSize = 64;
+	// how long Stop() waits for the control thread to finish
+	const static unsigned StopTimeout_ms = 1000;
+
+	Locomotive& locomotive;
+	Controller* controller;
+	std::thread worker;
+	sem_t pending;
+	sem_t finished;					// the control thread is done
+	bool isStopping;
+	std::atomic<bool> isThreaded;
+	SpscRing<Event, QueueSize> events;
+	LatencyHistogram latencies[Event::NUM_TYPES];	// uS
+	unsigned long numDeferred;		// found the ring full
+	unsigned long numDropped;		// ticks
+
+	// held back while the ring was full, on the acquisition thread; an odometry event
+	// keeps the arrival of the first it holds
+	Event pendingOdometry;
+	Event pendingEdge;
+	bool isOdometryPending;
+	bool isEdgePending;
+
+	bool Push(const Event& event);
+	void Post(const Event& event);
+	void Run(const Event& event);
+	void Work();
+
+public:
+	ControlPipeline(Locomotive& locomotive);
+	~ControlPipeline();
+
+	void SetController(Controller* _controller)
+	{
+		controller = _controller;
+	}
+
+	void Start();
+	// false if the control thread did not finish within StopTimeout_ms, it is then left
+	// running and the pipeline must not be deleted
+	bool Stop();
+	bool IsThreaded() const
+	{
+		return isThreaded.load(std::memory_order_acquire);
+	}
+	bool IsControlThread() const
+	{
+		return IsThreaded() && std::this_thread::get_id() == worker.get_id();
+	}
+
+	// acquisition side
+	void Odometry(const unsigned counts[2], const float intervals[2]);
+	void OnEdge(enum EdgeDetector::EDGE_SENSORS edge);
+	// the controller's tick, register the pipeline with the event loop for it
+	void Routine();
+
+	// BREAK both motors, from the control thread, or on it when called from any other
+	void EmergencyStop();
+
+	const LatencyHistogram& GetLatencies(Event::TYPE type) const
+	{
+		return latencies[type];
+	}
+	void Print(FILE* fp) const;
+};
+
+#endif /* INCLUDE_PIPELINE_H_ */
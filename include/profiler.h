@@ -0,0 +1,102 @@
+/*
+ *  profiler.h
+ *
+ *  Description: Opt-in profiler for the event loop.  Every periodic routine and peripheral
+ *  handler opens a PROFILE_CALLBACK() scope, which, when the profiler is enabled, records
+ *  for that callback:
+ *      - the call count and min/mean/p99/max execution time
+ *      - the scheduling jitter of each start relative to its nominal period
+ *      - overruns, where a run took longer than the period
+ *      - missed deadlines, where a start came more than half a period late
+ *  The table is printed at shutdown.  When the profiler is disabled a scope costs two
+ *  branches, inline: on the guard of its static slot, set once the slot is constructed,
+ *  and on the enabled flag.
+ *
+ *  Execution time is measured on the CPU's monotonic clock; the start times used for
+ *  jitter come from MonotonicTime_us(), i.e. the event loop's own clock.
+ */
+
+#ifndef INCLUDE_PROFILER_H_
+#define INCLUDE_PROFILER_H_
+
+#include <stdint.h>
+#include <cstdio>
+#include <atomic>
+#include "latency.h"
+
+class ProfileSlot
+{
+	friend class Profiler;
+
+private:
+	const char* name;
+	unsigned period;			// nominal period in mS, 0 if it has none
+	uint64_t lastStart_us;
+	LatencyHistogram execTimes;	// nS
+	LatencyHistogram jitters;	// uS
+	unsigned long overruns;
+	unsigned long missedDeadlines;
+
+public:
+	ProfileSlot(const char* _name, unsigned _period);
+	void Started(uint64_t start_us);
+	void Finished(uint64_t execTime_ns);
+};
+
+class Profiler
+{
+private:
+	const static unsigned MaxSlots = 32;
+	bool isEnabled;
+	ProfileSlot* slots[MaxSlots];
+	std::atomic<unsigned> numSlots;		// callbacks may first run on different threads
+
+public:
+	Profiler();
+	void Enable()
+	{
+		isEnabled = true;
+	}
+	bool IsEnabled() const
+	{
+		return isEnabled;
+	}
+	void Add(ProfileSlot* slot);
+	void Print(FILE* fp) const;
+
+	// the execution time clock
+	static uint64_t Now_ns();
+};
+
+extern Profiler profiler;
+
+// times the enclosing scope against its slot
+class ProfileScope
+{
+private:
+	ProfileSlot* slot;
+	uint64_t start_ns;
+
+	void Start(ProfileSlot& _slot);
+
+public:
+	ProfileScope(ProfileSlot& _slot) : slot(0), start_ns(0)
+	{
+		if (profiler.IsEnabled())
+			Start(_slot);
+	}
+	~ProfileScope()
+	{
+		if (slot)
+		{
+			slot->Finished(Profiler::Now_ns() - start_ns);
+		}
+	}
+};
+
+// profile the rest of the enclosing callback under the given name and nominal period
+#define PROFILE_CALLBACK(name, period) \
+	static ProfileSlot profileSlot(name, period); \
+	ProfileScope profileScope(profileSlot)
+
+#endif /* INCLUDE_PROFILER_H_ */
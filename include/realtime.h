@@ -0,0 +1,53 @@
+/*
+ *  realtime.h
+ *
+ *  Description: Real-time scheduling for the event loop.  EnterRealtime() takes the
+ *  steps that keep Linux from delaying the loop, in order:
+ *      1. lock all current and future memory, and keep freed heap, so nothing is paged
+ *      2. pre-fault StackPrefault bytes of the stack
+ *      3. pin the calling thread to a CPU: the first isolated one (isolcpus=), else the
+ *         last one, so that the rest of the system favours the others
+ *      4. run it under SCHED_FIFO at FifoPriority
+ *  Each step that is not permitted, e.g. without CAP_IPC_LOCK or CAP_SYS_NICE or in an
+ *  unprivileged container, is skipped with a warning and the rest are still taken.
+ *  Threads started before the call keep the normal policy and every CPU.
+ *
+ *  JitterProbe measures how well it works: ticked from a periodic routine, it keeps the
+ *  interval between ticks against the nominal period and prints the deviation.
+ *
+ *  Interface:
+ *    - EnterRealtime(): take the steps, returning how many were; reports to a file
+ *    - JitterProbe: Tick() on every run of a periodic routine, Print() the report
+ */
+
+#ifndef INCLUDE_REALTIME_H_
+#define INCLUDE_REALTIME_H_
+
+#include <stdint.h>
+#include <cstdio>
+#include "latency.h"
+
+const unsigned StackPrefault = 256 * 1024;
+// below the kernel's threaded interrupt handlers, so dpserver's I/O still gets through
+const int FifoPriority = 40;
+
+// the number of the 4 steps that were taken
+unsigned EnterRealtime(FILE* fp);
+
+class JitterProbe
+{
+private:
+	unsigned period;			// nominal, mS
+	uint64_t lastTick_us;
+	uint64_t minInterval_us;
+	uint64_t maxInterval_us;
+	LatencyHistogram lateness;	// uS past the nominal period
+	unsigned long earlyTicks;
+
+public:
+	JitterProbe(unsigned _period);
+	void Tick(uint64_t now_us);
+	void Print(FILE* fp, const char* name) const;
+};
+
+#endif /* INCLUDE_REALTIME_H_ */
@@ -3,7 +3,10 @@
  *
  *  Description: Class to implement a behavior control program for jefebot that performs
  *  the requirements of the HBRC Table Top Challenge level 1, e.g. traverse a table without
- *  falling off.  The details of how this is implemented is in the file roam_controller.cpp.
+ *  falling off.  The controller ticks every Period mS and on every new edge, OnEdge(); on
+ *  an edge or an object it submits an avoidance sequence to the locomotive, which calls
+ *  OnMotionComplete() once the bot is moving forward again.  The details of how this is
+ *  implemented is in the file roam_controller.cpp.
  *
  *  Created on: Mar 2, 2017
  *      Author: jeff
@@ -14,18 +17,46 @@
 
 #include "controller.h"
 
-class RoamController : public Controller
+class RoamController : public Controller, public Locomotive::MotionHandler
 {
 private:
-	enum STATE {ROAM, BACKUP, AVOID_EDGE, TURN} state;
+	enum STATE {ROAM, AVOID_EDGE, NUM_STATES};
+
+	// an object seen farther off the nose than this, in radians, is off to that side
+	constexpr static float ObjectSideAngle = 0.1;
+	float objectAngle;
+
+	// state actions
+	void Roam();
+	void AvoidEdge();
+
+	typedef StateRow<RoamController, STATE> Row;
+	constexpr static Row States[NUM_STATES] =
+	{
+		{ROAM,       "ROAM",       0,                           &RoamController::Roam, StateSet(AVOID_EDGE)},
+		{AVOID_EDGE, "AVOID_EDGE", &RoamController::AvoidEdge, 0,                     StateSet(ROAM)}
+	};
+	StateMachine<RoamController, STATE, NUM_STATES, States, ControllerTracer, StateTimes<NUM_STATES>> machine;
 
 protected:
 	void Routine();
 
+	// the avoidance sequence is complete and the bot is moving forward again
+	void OnMotionComplete();
+
 public:
 	RoamController(Context& ctx, bool isVerbose);
 	~RoamController()
 	{}
+
+	const char* StateName() const
+	{
+		return machine.Name();
+	}
+	void PrintStateTimes(FILE* fp) const
+	{
+		machine.PrintTimes(fp);
+	}
 };
 
 #endif /* INCLUDE_ROAM_CONTROLLER_H_ */
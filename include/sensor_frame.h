@@ -0,0 +1,109 @@
+/*
+ *  sensor_frame.h
+ *
+ *  Description: A coherent, timestamped snapshot of all of jefebot's sensors.  Each
+ *  peripheral publishes its part of the frame as its packets arrive, and a controller
+ *  reads one whole frame at the start of each tick, so every decision in that tick is
+ *  made from the same values and the age of each value is known.
+ *
+ *  The frame is double buffered with a sequence lock per buffer: the writer always fills
+ *  the buffer that was not published last, and a reader retries only in the rare case
+ *  that the writer lapped it while it was copying.  Parts may be published from more
+ *  than one thread, e.g. the odometry from the control thread, see pipeline.h, so the
+ *  writers take turns on a spin lock, held only to fill and copy the frame; readers
+ *  never take it.
+ *
+ *  Interface:
+ *    - PublishEdges(), PublishRanges(), PublishOdometry(), PublishBattery(): update part of
+ *      the frame, called from the peripheral handlers
+ *    - Read(): copy the latest complete frame
+ */
+
+#ifndef INCLUDE_SENSOR_FRAME_H_
+#define INCLUDE_SENSOR_FRAME_H_
+
+#include <stdint.h>
+#include <atomic>
+
+// the bot's 2-D pose dead reckoned from the wheel encoders, relative to where it started
+struct Pose
+{
+	float x;					// cm along the starting heading
+	float y;					// cm to the left of it
+	float heading;				// radians CCW from the starting heading, -pi..pi
+	float covariance[3][3];		// of (x, y, heading)
+	float odometer;				// total path length in cm
+	float rotation;				// total absolute rotation in radians
+};
+
+// each part of the frame carries the time it was published, 0 if it never has been
+struct SensorFrame
+{
+	unsigned sequence;			// incremented on every publish
+
+	// Sharp edge sensors, indexed by EdgeDetector::EDGE_SENSORS
+	uint64_t edgeTime_us;
+	unsigned edge_mV[3];
+	unsigned edges;				// mask of the sensors at an edge, after filtering
+
+	// Ping))) range sensors, indexed by MultiPingRangeSensor mount; the first is the nose
+	// sensor, whose reading is also the range
+	uint64_t rangeTime_us;
+	unsigned distance;
+	uint64_t rangeTimes_us[4];
+	unsigned ranges[4];
+
+	// wheel encoders, indexed by Locomotive::SIDE
+	uint64_t odometryTime_us;
+	int ticks[2];				// accumulated, signed
+	unsigned counts[2];			// in the last Count4 update
+	float intervals[2];
+	Pose pose;
+
+	// battery, the level is a BatteryEstimator::LEVEL
+	uint64_t batteryTime_us;
+	float batteryVoltage;
+	float stateOfCharge;		// 0..1
+	float batteryRuntime;		// S left
+	unsigned batteryLevel;
+};
+
+class SensorFrameBuffer
+{
+private:
+	struct Slot
+	{
+		std::atomic<unsigned> sequence;		// odd while being written
+		SensorFrame frame;
+	};
+
+	Slot slots[2];
+	std::atomic<unsigned> latest;		// index of the last published slot
+	std::atomic_flag writerLock;
+	SensorFrame pending;				// the writer's working copy
+
+	void Lock()
+	{
+		while (writerLock.test_and_set(std::memory_order_acquire))
+			;
+	}
+	void Unlock()
+	{
+		writerLock.clear(std::memory_order_release);
+	}
+	void Publish();
+
+public:
+	SensorFrameBuffer();
+
+	// writer side
+	void PublishEdges(const unsigned edge_mV[3], unsigned edges);
+	void PublishRanges(unsigned mask, const unsigned distances[4]);
+	void PublishOdometry(const int ticks[2], const unsigned counts[2], const float intervals[2], const Pose& pose);
+	void PublishBattery(float voltage, float stateOfCharge, float runtime, unsigned level);
+
+	// reader side
+	void Read(SensorFrame* frame) const;
+};
+
+#endif /* INCLUDE_SENSOR_FRAME_H_ */
@@ -0,0 +1,79 @@
+/*
+ *  sharp_gp2y0a21.h
+ *
+ *  Description: Voltage to distance conversion for the Sharp GP2Y0A21YK0F distance sensor.
+ *  The sensor's output falls non-linearly with distance, so the conversion interpolates
+ *  the datasheet curve.  It does so at compile time: SharpDistanceTable is a constexpr
+ *  table of the distance at every mV the ADC812 can report, 0 to its 3.3V full scale,
+ *  which is finer than its 12-bit code, so a conversion is a single load with no division.
+ *
+ *  The sensor measures 10 to 80 cm, and the curve covers just that.  A voltage above the
+ *  curve, i.e. nearer than 10 cm, reads as 10 cm; one below it, i.e. out of range or
+ *  nothing there, reads as MaxDistance_cm.
+ *
+ *  Interface:
+ *    - ToDistance_cm(): the distance of a sample
+ */
+
+#ifndef INCLUDE_SHARP_GP2Y0A21_H_
+#define INCLUDE_SHARP_GP2Y0A21_H_
+
+#include <stdint.h>
+
+class SharpDistanceTable
+{
+public:
+	const static unsigned FullScale_mV = 3300;
+	const static unsigned MaxDistance_cm = 80;
+
+private:
+	struct Point
+	{
+		unsigned distance_cm;
+		unsigned voltage_mV;
+	};
+
+	// datasheet curve for a white reflector, in order of distance, over the measured range
+	constexpr static Point Curve[] =
+	{
+		{10, 2300}, {15, 1650}, {20, 1300}, {25, 1080}, {30, 920}, {40, 750},
+		{50, 600}, {60, 500}, {70, 450}, {80, 400}
+	};
+	constexpr static unsigned CurveLength = sizeof(Curve) / sizeof(Curve[0]);
+
+	uint8_t distances_cm[FullScale_mV + 1];
+
+	// interpolated between the two points around the voltage, rounded to the nearest cm
+	constexpr static unsigned Interpolate(unsigned voltage_mV)
+	{
+		if (voltage_mV >= Curve[0].voltage_mV)
+			return Curve[0].distance_cm;
+
+		for (unsigned i = 1; i < CurveLength; ++i)
+		{
+			if (voltage_mV >= Curve[i].voltage_mV)
+			{
+				unsigned span_mV = Curve[i - 1].voltage_mV - Curve[i].voltage_mV;
+				unsigned span_cm = Curve[i].distance_cm - Curve[i - 1].distance_cm;
+				unsigned below_mV = Curve[i - 1].voltage_mV - voltage_mV;
+				return Curve[i - 1].distance_cm + (below_mV * span_cm + span_mV / 2) / span_mV;
+			}
+		}
+
+		return MaxDistance_cm;
+	}
+
+public:
+	constexpr SharpDistanceTable() : distances_cm()
+	{
+		for (unsigned mV = 0; mV <= FullScale_mV; ++mV)
+			distances_cm[mV] = Interpolate(mV);
+	}
+
+	constexpr unsigned ToDistance_cm(unsigned sample_mV) const
+	{
+		return distances_cm[(sample_mV < FullScale_mV) ? sample_mV : FullScale_mV];
+	}
+};
+
+#endif /* INCLUDE_SHARP_GP2Y0A21_H_ */
@@ -0,0 +1,126 @@
+/*
+ *  sound.h
+ *
+ *  Description: Sound playback that never blocks the event loop.  The sounds are read
+ *  into memory once, at startup, and Play() only queues a request for a worker thread,
+ *  which hands the preloaded clip to a sink.  The queue is an SpscRing, so queueing a
+ *  sound takes no lock and makes only one system call, the sem_post() that wakes the
+ *  worker.
+ *
+ *  Interface:
+ *    - Load(): read the sounds, WAV files named after the SOUND, from a directory
+ *    - Start(): start the worker thread playing to a sink; Stop(): let it finish the
+ *      queued sounds, then join it
+ *    - Play(): queue a sound, from one thread only: the event loop's, or the control
+ *      thread's when there is one, see pipeline.h
+ *  Sinks:
+ *    - NullSoundSink: counts the clips it is given, for the simulated backend
+ *    - FileSoundSink: appends each clip to a file
+ *    - PipeSoundSink: writes each clip to a player command, e.g. aplay, on the Pi; the
+ *      worker blocks SIGPIPE, so a player that is missing or exits early fails the clip,
+ *      reported on stderr, and nothing else
+ *  There is a single instance, soundPlayer.
+ */
+
+#ifndef INCLUDE_SOUND_H_
+#define INCLUDE_SOUND_H_
+
+#include <stdint.h>
+#include <cstdio>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <semaphore.h>
+#include "spsc_ring.h"
+
+class SoundSink
+{
+public:
+	virtual ~SoundSink()
+	{}
+	// play a whole WAV file, returning when it has been handed over
+	virtual void Play(const char* name, const std::vector<uint8_t>& wav) = 0;
+};
+
+class NullSoundSink : public SoundSink
+{
+private:
+	std::atomic<unsigned> numPlayed;
+
+public:
+	NullSoundSink() : numPlayed(0)
+	{}
+	void Play(const char* name, const std::vector<uint8_t>& wav)
+	{
+		++numPlayed;
+	}
+	unsigned NumPlayed() const
+	{
+		return numPlayed;
+	}
+};
+
+class FileSoundSink : public SoundSink
+{
+private:
+	FILE* fp;
+
+public:
+	FileSoundSink(const char* path);
+	~FileSoundSink();
+	void Play(const char* name, const std::vector<uint8_t>& wav);
+};
+
+class PipeSoundSink : public SoundSink
+{
+private:
+	const char* command;
+
+public:
+	PipeSoundSink(const char* _command) : command(_command)
+	{}
+	void Play(const char* name, const std::vector<uint8_t>& wav);
+};
+
+class SoundPlayer
+{
+public:
+	enum SOUND {SOUND_WAWA, SOUND_WOOHOO, NUM_SOUNDS};
+
+private:
+	const static unsigned QueueSize = 8;
+
+	std::vector<uint8_t> sounds[NUM_SOUNDS];
+	SoundSink* sink;
+	std::thread worker;
+	sem_t pending;
+	bool isStopping;
+
+	// the requests, pushed by Play() and popped by the worker
+	SpscRing<SOUND, QueueSize> queue;
+
+	void Work();
+
+public:
+	SoundPlayer();
+	~SoundPlayer();
+
+	// load every sound found in dir, returning how many were; a missing one plays nothing
+	unsigned Load(const char* dir);
+
+	void Start(SoundSink* sink);
+	void Stop();
+	bool IsStarted() const
+	{
+		return sink != 0;
+	}
+
+	// queue a sound, false if it could not be, e.g. the queue is full
+	bool Play(SOUND sound);
+
+	static const char* Name(SOUND sound);
+};
+
+extern SoundPlayer soundPlayer;
+
+#endif /* INCLUDE_SOUND_H_ */
@@ -0,0 +1,23 @@
+/*
+ *  spi.h
+ *
+ *  Description: Thin transport layer over the Linux spidev interface used by the ADC class.
+ *  The real implementation in spi.cpp talks to /dev/spidev*; the simulated backend in sim/
+ *  supplies its own implementation that models an MCP3008 so the ADC can run headless.
+ *
+ *  Interface:
+ *    - SPIOpen(): open and configure an SPI device, return an fd or -1
+ *    - SPITransfer(): submit an array of full duplex transfers on an open SPI device as a
+ *      single message, return -1 on error
+ */
+
+#ifndef INCLUDE_SPI_H_
+#define INCLUDE_SPI_H_
+
+#include <stdint.h>
+#include <linux/spi/spidev.h>
+
+int SPIOpen(const char *dev, uint8_t mode, uint8_t bits, uint32_t speed);
+int SPITransfer(int fd, struct spi_ioc_transfer *tr, unsigned count);
+
+#endif /* INCLUDE_SPI_H_ */
@@ -0,0 +1,69 @@
+/*
+ *  spsc_ring.h
+ *
+ *  Description: Lock-free ring of fixed size items between exactly one producer thread
+ *  and one consumer thread.  Each side owns one index and only reads the other's, so a
+ *  push or a pop is a copy of the item and two atomic accesses, with no lock and no
+ *  system call; the indices are padded a cache line apart so the two threads do not keep
+ *  taking the line from each other.  A push to a full ring fails rather than wait,
+ *  what to do then is the producer's call.
+ *
+ *  Waking the consumer is left to the user of the ring, e.g. with a semaphore.
+ *
+ *  Interface:
+ *    - Push(): from the producer thread only, false if the ring is full
+ *    - Pop(): from the consumer thread only, false if the ring is empty
+ *    - Size(): the number of items in the ring, from either thread
+ */
+
+#ifndef INCLUDE_SPSC_RING_H_
+#define INCLUDE_SPSC_RING_H_
+
+#include <atomic>
+
+template <class T, unsigned Capacity>
+class SpscRing
+{
+private:
+	static_assert(Capacity && (Capacity & (Capacity - 1)) == 0, "the capacity of a ring must be a power of 2");
+	const static unsigned CacheLine = 64;
+
+	std::atomic<unsigned> head;		// items ever pushed, written by the producer
+	char headPad[CacheLine];
+	std::atomic<unsigned> tail;		// items ever popped, written by the consumer
+	char tailPad[CacheLine];
+	T items[Capacity];
+
+public:
+	SpscRing() : head(0), tail(0)
+	{}
+
+	bool Push(const T& item)
+	{
+		unsigned h = head.load(std::memory_order_relaxed);
+
+		if (h - tail.load(std::memory_order_acquire) == Capacity)
+			return false;
+		items[h & (Capacity - 1)] = item;
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool Pop(T* item)
+	{
+		unsigned t = tail.load(std::memory_order_relaxed);
+
+		if (t == head.load(std::memory_order_acquire))
+			return false;
+		*item = items[t & (Capacity - 1)];
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+	unsigned Size() const
+	{
+		return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+	}
+};
+
+#endif /* INCLUDE_SPSC_RING_H_ */
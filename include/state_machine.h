@@ -0,0 +1,221 @@
+/*
+ *  state_machine.h
+ *
+ *  Description: Table driven state machine for the controllers.  A controller declares
+ *  its states in a constexpr table with a row per state, in state order, giving the
+ *  state's name, its entry action, its tick action and the states it may change to:
+ *
+ *      constexpr static Row States[NUM_STATES] =
+ *      {
+ *          {ROAM,       "ROAM",       0,                           &RoamController::Roam, StateSet(AVOID_EDGE)},
+ *          {AVOID_EDGE, "AVOID_EDGE", &RoamController::AvoidEdge, 0,                     StateSet(ROAM)}
+ *      };
+ *      StateMachine<RoamController, STATE, NUM_STATES, States, ControllerTracer, StateTimes<NUM_STATES>> machine;
+ *
+ *  The table is a template argument, so Tick() compiles to an indexed load from a
+ *  constant table and an indirect call, the jump table a switch would compile to.
+ *  ChangeState() checks the transition against the table, runs the hooks, then the new
+ *  state's entry action.  The order of the rows is checked at compile time.
+ *
+ *  Tracing and timing are policy classes the machine derives from, so the defaults,
+ *  NullStateTracer and NullStateTimer, add neither size nor code:
+ *    - tracer: Started(row) when the machine starts, Changed(from, to) on a transition
+ *    - timer:  Entered(state) on start and on every transition, Print(fp, rows)
+ *  StateTimes is a timer that keeps how long each state lasted; it reads the clock once
+ *  per transition and never on a tick.
+ */
+
+#ifndef INCLUDE_STATE_MACHINE_H_
+#define INCLUDE_STATE_MACHINE_H_
+
+#include <stdint.h>
+#include <assert.h>
+#include <cstdio>
+#include "clock.h"
+
+template <class Owner, typename State>
+struct StateRow
+{
+	typedef void (Owner::*Action)();
+
+	State state;
+	const char* name;
+	Action onEntry;		// 0 if the state has none
+	Action onTick;		// 0 if the state only waits for an event, e.g. a motion to complete
+	uint32_t next;		// the states it may change to, see StateSet()
+};
+
+// the mask of the given states for StateRow::next
+constexpr uint32_t StateSet()
+{
+	return 0;
+}
+template <typename... States>
+constexpr uint32_t StateSet(unsigned state, States... states)
+{
+	return (1u << state) | StateSet(states...);
+}
+
+// true if the table has a row for every state, in state order
+template <class Row>
+constexpr bool IsStateTableOrdered(const Row* rows, unsigned numStates, unsigned i = 0)
+{
+	return i == numStates || ((unsigned)rows[i].state == i && IsStateTableOrdered(rows, numStates, i + 1));
+}
+
+class NullStateTracer
+{
+public:
+	template <class Row>
+	void Started(const Row& row)
+	{}
+	template <class Row>
+	void Changed(const Row& from, const Row& to)
+	{}
+};
+
+class NullStateTimer
+{
+public:
+	void Entered(unsigned state)
+	{}
+	template <class Row>
+	void Print(FILE* fp, const Row* rows) const
+	{}
+};
+
+// how many times each state was entered and how long it lasted
+template <unsigned NumStates>
+class StateTimes
+{
+private:
+	unsigned current;
+	uint64_t enteredTime_us;
+	unsigned long entries[NumStates];
+	uint64_t total_us[NumStates];
+	uint64_t max_us[NumStates];
+
+public:
+	StateTimes() : current(NumStates), enteredTime_us(0)
+	{
+		for (unsigned i = 0; i < NumStates; ++i)
+		{
+			entries[i] = 0;
+			total_us[i] = 0;
+			max_us[i] = 0;
+		}
+	}
+
+	void Entered(unsigned state)
+	{
+		uint64_t now_us = MonotonicTime_us();
+
+		if (current < NumStates)
+		{
+			uint64_t duration_us = now_us - enteredTime_us;
+			total_us[current] += duration_us;
+			if (duration_us > max_us[current])
+				max_us[current] = duration_us;
+		}
+		current = state;
+		enteredTime_us = now_us;
+		++entries[state];
+	}
+
+	// the current state is counted up to now
+	template <class Row>
+	void Print(FILE* fp, const Row* rows) const
+	{
+		uint64_t now_us = MonotonicTime_us();
+
+		fprintf(fp, "%-24s %8s %10s %10s %10s\n", "state", "entries", "total S", "mean mS", "max mS");
+		for (unsigned i = 0; i < NumStates; ++i)
+		{
+			uint64_t total = total_us[i];
+			uint64_t max = max_us[i];
+			if (i == current)
+			{
+				total += now_us - enteredTime_us;
+				if (now_us - enteredTime_us > max)
+					max = now_us - enteredTime_us;
+			}
+			fprintf(fp, "%-24s %8lu %10.3f %10.1f %10.1f\n", rows[i].name, entries[i],
+				total / 1e6, entries[i] ? total / 1e3 / entries[i] : 0.0, max / 1e3);
+		}
+	}
+};
+
+template <
+	class Owner,
+	typename State,
+	unsigned NumStates,
+	const StateRow<Owner, State>* Rows,
+	class Tracer = NullStateTracer,
+	class Timer = NullStateTimer
+>
+class StateMachine : private Tracer, private Timer
+{
+	static_assert(NumStates <= 32, "a state machine has at most 32 states");
+
+private:
+	Owner& owner;
+	State state;
+
+	void Enter()
+	{
+		if (Rows[state].onEntry)
+			(owner.*Rows[state].onEntry)();
+	}
+
+public:
+	typedef StateRow<Owner, State> Row;
+
+	StateMachine(Owner& _owner, const Tracer& tracer = Tracer(), const Timer& timer = Timer()) :
+		Tracer(tracer), Timer(timer), owner(_owner), state(Rows[0].state)
+	{
+		static_assert(IsStateTableOrdered(Rows, NumStates), "state table rows must be in state order");
+	}
+
+	// enter the initial state, running its entry action
+	void Start(State initial)
+	{
+		state = initial;
+		Tracer::Started(Rows[state]);
+		Timer::Entered(state);
+		Enter();
+	}
+
+	State Current() const
+	{
+		return state;
+	}
+	const char* Name() const
+	{
+		return Rows[state].name;
+	}
+
+	// run the current state's tick action
+	void Tick()
+	{
+		if (Rows[state].onTick)
+			(owner.*Rows[state].onTick)();
+	}
+
+	// change to a state the current one may change to, running its entry action
+	void ChangeState(State to)
+	{
+		assert((unsigned)to < NumStates && (Rows[state].next & (1u << to)));
+
+		Tracer::Changed(Rows[state], Rows[to]);
+		Timer::Entered(to);
+		state = to;
+		Enter();
+	}
+
+	void PrintTimes(FILE* fp) const
+	{
+		Timer::Print(fp, Rows);
+	}
+};
+
+#endif /* INCLUDE_STATE_MACHINE_H_ */
@@ -0,0 +1,168 @@
+/*
+ *  telemetry.h
+ *
+ *  Description: Live telemetry over a Unix domain datagram socket, to watch a mission
+ *  without printing from it.  Each packet is a TelemetryPacket, a fixed binary layout
+ *  sent as it is, with no encoding, straight from the one packet the publisher keeps:
+ *    - the sensor frame, read into the packet when it is sent
+ *    - Locomotive's motor commands and the error of its speed regulators
+ *    - the controller's state
+ *  The last three are stored into the packet where they change, by the same hooks as
+ *  feed the flight recorder, as relaxed atomic stores of 32 bit fields; the control path
+ *  never takes a lock nor makes a system call for telemetry, subscribed or not, and
+ *  each field of a packet is whole although the packet may be a few uS short of a
+ *  snapshot.  The state's name is double buffered, see StateChanged().
+ *
+ *  A subscriber binds a socket of its own and sends a TelemetryRequest to the
+ *  publisher's, then renews it at least every SubscriptionTimeout_us; Publish(), run by
+ *  the event loop, takes the requests and sends a packet to each subscriber.  When
+ *  nobody is subscribed, Publish() costs one recvfrom() that finds nothing.  A subscriber
+ *  too slow to take a packet misses it, the publisher never waits; packets are numbered,
+ *  so the subscriber can tell.  The subscriber, tools/telemetry_sub.cpp, prints them as
+ *  CSV.
+ *
+ *  Interface:
+ *    - Open(): bind the socket at a path, replacing any stale one; Close(): unbind it
+ *    - MotorMode(), MotorPower(), SpeedError(): Locomotive's motor commands
+ *    - StateChanged(): a controller state transition
+ *    - Publish(): serve the requests and send the packet, from the event loop
+ *    - Print(): how many packets were sent and missed
+ *  There is a single instance, telemetry.
+ */
+
+#ifndef INCLUDE_TELEMETRY_H_
+#define INCLUDE_TELEMETRY_H_
+
+#include <stdint.h>
+#include <cstdio>
+#include <cstring>
+#include <atomic>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "sensor_frame.h"
+#include "flight_recorder.h"
+
+static_assert(sizeof(std::atomic<float>) == 4 && sizeof(std::atomic<int32_t>) == 4, "telemetry fields must be 32 bits");
+
+struct TelemetryPacket
+{
+	const static unsigned Version = 1;
+	const static unsigned MaxStateName = 16;
+
+	char magic[4];					// "JTLM"
+	uint16_t version;
+	uint16_t size;					// sizeof(TelemetryPacket)
+	uint32_t sequence;				// packets ever published, a gap is a missed packet
+	uint32_t reserved;
+	uint64_t time_us;				// MonotonicTime_us() when published
+
+	SensorFrame frame;
+
+	// DC2 commands and speed regulators, indexed by Locomotive::SIDE
+	std::atomic<int32_t> modes[2];			// DC2 mode characters, 0 before the first
+	std::atomic<float> powers[2];			// %
+	std::atomic<float> speedErrors[2];		// ticks/S
+	std::atomic<float> adjustments[2];		// % power over the default speed
+
+	// the controller, a RECORD_SOURCE, -1 before it starts; the name of its state is
+	// stateNames[numTransitions & 1]
+	std::atomic<int32_t> controller;
+	std::atomic<int32_t> state;
+	std::atomic<uint32_t> numTransitions;
+	uint32_t reserved2;
+	char stateNames[2][MaxStateName];
+
+	// check that a datagram of the given size is a packet this code can read
+	bool IsValid(size_t length) const
+	{
+		return (
+			length == sizeof(TelemetryPacket) &&
+			memcmp(magic, "JTLM", 4) == 0 &&
+			version == Version &&
+			size == sizeof(TelemetryPacket)
+		);
+	}
+};
+
+// from a subscriber to the publisher, to subscribe or renew, or to unsubscribe
+struct TelemetryRequest
+{
+	char magic[4];					// "JTLR"
+	uint16_t version;				// TelemetryPacket::Version
+	uint16_t isSubscribing;
+};
+
+static_assert(sizeof(TelemetryPacket) == 312, "telemetry packet layout changed");
+static_assert(sizeof(TelemetryRequest) == 8, "telemetry request layout changed");
+
+class Telemetry
+{
+public:
+	const static unsigned MaxSubscribers = 4;
+	// a subscription lapses unless renewed within this
+	const static uint64_t SubscriptionTimeout_us = 3000000;
+
+private:
+	struct Subscriber
+	{
+		struct sockaddr_un addr;
+		socklen_t addrLength;
+		uint64_t lastRequest_us;
+	};
+
+	int fd;
+	char path[sizeof(((struct sockaddr_un*)0)->sun_path)];
+	TelemetryPacket packet;
+	Subscriber subscribers[MaxSubscribers];
+	unsigned numSubscribers;
+	unsigned long numSent;
+	unsigned long numMissed;		// a subscriber's socket was full
+
+	void Subscribe(const struct sockaddr_un& addr, socklen_t addrLength, bool isSubscribing, uint64_t now_us);
+	void Unsubscribe(unsigned index);
+
+public:
+	Telemetry();
+	~Telemetry();
+
+	void Open(const char* path);
+	void Close();
+	bool IsOpen() const
+	{
+		return fd >= 0;
+	}
+
+	void MotorMode(char modeL, char modeR)
+	{
+		packet.modes[0].store(modeL, std::memory_order_relaxed);
+		packet.modes[1].store(modeR, std::memory_order_relaxed);
+	}
+	void MotorPower(float powerL, float powerR)
+	{
+		packet.powers[0].store(powerL, std::memory_order_relaxed);
+		packet.powers[1].store(powerR, std::memory_order_relaxed);
+	}
+	void SpeedError(unsigned side, float error, float adjustment)
+	{
+		packet.speedErrors[side].store(error, std::memory_order_relaxed);
+		packet.adjustments[side].store(adjustment, std::memory_order_relaxed);
+	}
+	// from one thread only; the name goes into the buffer no packet refers to yet, so one
+	// being sent keeps a whole name unless two transitions come within the send
+	void StateChanged(RECORD_SOURCE controller, int state, const char* name)
+	{
+		uint32_t n = packet.numTransitions.load(std::memory_order_relaxed) + 1;
+
+		snprintf(packet.stateNames[n & 1], TelemetryPacket::MaxStateName, "%s", name);
+		packet.controller.store(controller, std::memory_order_relaxed);
+		packet.state.store(state, std::memory_order_relaxed);
+		packet.numTransitions.store(n, std::memory_order_release);
+	}
+
+	void Publish(const SensorFrameBuffer& sensors);
+	void Print(FILE* fp) const;
+};
+
+extern Telemetry telemetry;
+
+#endif /* INCLUDE_TELEMETRY_H_ */
@@ -0,0 +1,48 @@
+/*
+ *  dp_adc812.h
+ *
+ *  Description: Simulated DP ADC812 octal 12-bit ADC with a 3.3V full scale.  Channels 1-3
+ *  are wired to the left, front and right Sharp edge sensors.
+ */
+
+#ifndef DP_ADC812_H_
+#define DP_ADC812_H_
+
+#include "dp_peripherals.h"
+
+namespace DP
+{
+
+class ADC812 : public Peripheral
+{
+private:
+	static const unsigned DefaultUpdatePeriod = 100;
+	unsigned samples[8];
+
+protected:
+	void Handler();
+	int ReplayStream() const
+	{
+		return Sim::Replay::EDGES;
+	}
+
+public:
+	enum CHANNELS {CHANNEL_1 = 0, CHANNEL_2, CHANNEL_3, CHANNEL_4, CHANNEL_5, CHANNEL_6, CHANNEL_7, CHANNEL_8};
+	enum PAIRS {NO_PAIRS = 0, PAIR_12 = 0x01, PAIR_34 = 0x02, PAIR_56 = 0x04, PAIR_78 = 0x08};
+	static const unsigned FullScale_mV = 3300;
+	static const unsigned MaxCode = 4095;
+
+	ADC812(EventContext& evtCtx, const char* slot);
+	void Config(unsigned period, unsigned pairs)
+	{
+		SetUpdatePeriod(period);
+	}
+	unsigned GetSample_mV(unsigned channel)
+	{
+		return samples[channel];
+	}
+};
+
+} // namespace DP
+
+#endif /* DP_ADC812_H_ */
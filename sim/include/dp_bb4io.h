@@ -0,0 +1,41 @@
+/*
+ *  dp_bb4io.h
+ *
+ *  Description: Simulated DP BB4IO peripheral, the buttons and LEDs on the baseboard.
+ */
+
+#ifndef DP_BB4IO_H_
+#define DP_BB4IO_H_
+
+#include "dp_peripherals.h"
+
+namespace DP
+{
+
+class BB4IO : public Peripheral
+{
+private:
+	static const unsigned UpdatePeriod = 50;
+	unsigned char buttons;
+	unsigned char leds;
+
+protected:
+	void Handler();
+
+public:
+	enum BUTTONS {S1 = 0x01, S2 = 0x02, S3 = 0x04};
+
+	BB4IO(EventContext& evtCtx);
+	void SetLeds(unsigned char pattern)
+	{
+		leds = pattern;
+	}
+	bool IsButtonPressed(int button)
+	{
+		return (buttons & button) != 0;
+	}
+};
+
+} // namespace DP
+
+#endif /* DP_BB4IO_H_ */
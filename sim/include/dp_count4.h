@@ -0,0 +1,55 @@
+/*
+ *  dp_count4.h
+ *
+ *  Description: Simulated DP COUNT4 quad event counter.  Inputs 0 and 1 are wired to the
+ *  left and right wheel encoders.  Each packet reports, per input, the number of edges
+ *  seen during the update period and the interval in seconds spanned by those edges.
+ */
+
+#ifndef DP_COUNT4_H_
+#define DP_COUNT4_H_
+
+#include "dp_peripherals.h"
+
+namespace DP
+{
+
+class COUNT4 : public Peripheral
+{
+private:
+	static const unsigned DefaultUpdatePeriod = 100;
+	int edgeModes[4];
+	unsigned counts[4];
+	float intervals[4];
+	unsigned reportedEdges[2];
+	double reportedEdgeTimes[2];
+
+protected:
+	void Handler();
+	int ReplayStream() const
+	{
+		return Sim::Replay::ODOMETRY;
+	}
+
+public:
+	enum EDGES {DISABLE_EDGE = 0, RISING_EDGE, FALLING_EDGE, BOTH_EDGES};
+
+	COUNT4(EventContext& evtCtx, const char* slot);
+	void SetUpdateRate(unsigned period)
+	{
+		SetUpdatePeriod(period);
+	}
+	void SetEdges(int edges0, int edges1, int edges2, int edges3);
+	unsigned GetCount(int input)
+	{
+		return counts[input];
+	}
+	float GetInterval(int input)
+	{
+		return intervals[input];
+	}
+};
+
+} // namespace DP
+
+#endif /* DP_COUNT4_H_ */
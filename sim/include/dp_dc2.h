@@ -0,0 +1,46 @@
+/*
+ *  dp_dc2.h
+ *
+ *  Description: Simulated DP DC2 dual DC motor controller.  Commands are applied to the
+ *  motors of the table-top model immediately, or captured for diffing when replaying.
+ */
+
+#ifndef DP_DC2_H_
+#define DP_DC2_H_
+
+#include "dp_peripherals.h"
+
+namespace DP
+{
+
+class DC2
+{
+private:
+	EventContext& evtCtx;
+	Sim::World& world;
+	const char* slot;
+	unsigned watchdog;
+	char modes[2];
+	float powers[2];
+
+	void Apply(int motor);
+
+public:
+	enum MODES {BREAK = 'b', FORWARD = 'f', REVERSE = 'r', COAST = 'c'};
+
+	DC2(EventContext& evtCtx, const char* _slot);
+	virtual ~DC2()
+	{}
+	void SetMode0(char mode);
+	void SetMode1(char mode);
+	void SetPower0(float power);
+	void SetPower1(float power);
+	void SetWatchdog(unsigned timeout)
+	{
+		watchdog = timeout;
+	}
+};
+
+} // namespace DP
+
+#endif /* DP_DC2_H_ */
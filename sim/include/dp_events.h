@@ -0,0 +1,185 @@
+/*
+ *  dp_events.h
+ *
+ *  Description: Simulated DP Framework event interface.  This mirrors the part of the
+ *  dp-framework API that jefebot uses, but instead of waiting on dpserver the event loop
+ *  runs on a virtual clock and the peripherals are fed by the table-top model in
+ *  sim_world.h, so a whole mission runs as fast as the CPU allows.
+ *
+ *  Or, for measuring the control program's threads against it, in real time: then the
+ *  loop sleeps until each virtual mS is due on CLOCK_MONOTONIC, and takes the motor
+ *  commands as dpserver does, through a queue it applies at the start of each mS, so
+ *  they may be sent from any one thread.
+ *
+ *  Interface:
+ *    - Callback: a periodic event handler, see BEGIN/END_PERIODIC_ROUTINE
+ *    - GenericSensor: a periodic handler that owns a device fd, e.g. the SPI ADC
+ *    - EventContext: registers callbacks and peripherals and runs the event loop, either
+ *      on the table-top model or on a flight record replay, see sim_replay.h
+ *    - InitControlProgram(), Shutdown(): supplied by the control program
+ */
+
+#ifndef DP_EVENTS_H_
+#define DP_EVENTS_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <vector>
+#include "spsc_ring.h"
+
+// framework error codes
+#define ERR_NONE				0
+#define ERR_INITIALIZATION		-1001
+#define ERR_READ				-1002
+#define ERR_WRITE				-1003
+#define ERR_SELECT				-1004
+#define ERR_PARAMS				-1005
+#define ERR_REGISTRATION		-1006
+
+namespace Sim
+{
+class World;
+class Replay;
+}
+
+namespace DP
+{
+
+class Peripheral;
+
+class FrameworkException
+{
+private:
+	const char* name;
+	int error;
+
+public:
+	FrameworkException(const char* _name, int _error) : name(_name), error(_error)
+	{}
+	const char* what() const
+	{
+		return name;
+	}
+	int Error() const
+	{
+		return error;
+	}
+};
+
+// a periodic event handler, the period is in mS
+class Callback
+{
+	friend class EventContext;
+
+private:
+	unsigned period;
+	unsigned long dueTime;
+
+public:
+	Callback(unsigned _period) : period(_period), dueTime(0)
+	{}
+	virtual ~Callback()
+	{}
+	virtual void Routine() = 0;
+};
+
+// a periodic sensor that is serviced by the control program rather than dpserver
+class GenericSensor : public Callback
+{
+protected:
+	int fd;
+
+public:
+	GenericSensor(unsigned _period) : Callback(_period), fd(-1)
+	{}
+};
+
+class EventContext
+{
+public:
+	// a DC2 command queued for the model, see SetRealTime()
+	struct MotorCommand
+	{
+		int motor;
+		int mode;			// Sim::World::MODE
+		float power;
+	};
+
+private:
+	const static unsigned CommandQueueSize = 64;
+
+	Sim::World& world;
+	Sim::Replay* replay;	// 0 unless replaying a flight record
+	unsigned long now;		// virtual time in mS
+	std::vector<Callback*> callbacks;
+	std::vector<Peripheral*> peripherals;
+	bool isRealTime;
+	uint64_t wallEpoch_ns;	// CLOCK_MONOTONIC of virtual time 0, when in real time
+	SpscRing<MotorCommand, CommandQueueSize> motorCommands;
+
+	void AwaitRealTime();
+	void DeliverReplay();
+
+public:
+	EventContext(Sim::World& _world, Sim::Replay* _replay = 0);
+
+	void Register(Callback* callback);
+	void Register(Peripheral* peripheral);
+
+	Sim::World& GetWorld()
+	{
+		return world;
+	}
+	Sim::Replay* GetReplay()
+	{
+		return replay;
+	}
+
+	// the current virtual time in mS
+	unsigned long Now() const
+	{
+		return now;
+	}
+
+	// run in real time from now on, or as fast as possible again; not with a replay
+	void SetRealTime(bool _isRealTime);
+	bool IsRealTime() const
+	{
+		return isRealTime;
+	}
+	// queue a motor command for the next mS, false if the queue is full
+	bool QueueMotorCommand(const MotorCommand& command)
+	{
+		return motorCommands.Push(command);
+	}
+
+	// run the event loop on virtual time until endTime (mS) or until the bot falls; when
+	// replaying, only the clock runs once the recording has ended
+	void Run(unsigned long endTime);
+};
+
+} // namespace DP
+
+// declare a periodic routine object named "name", the period is given after the END macro
+#define BEGIN_PERIODIC_ROUTINE(name) \
+	class name##Routine : public DP::Callback \
+	{ \
+	public: \
+		name##Routine(unsigned _period) : DP::Callback(_period) \
+		{} \
+		void Routine() \
+		{
+
+#define END_PERIODIC_ROUTINE(name) \
+		} \
+	} name
+
+// supplied by the control program
+void InitControlProgram(int argc, char* argv[], DP::EventContext& evtCtx);
+void Shutdown();
+void Shutdown(const char* msg, int error);
+
+#endif /* DP_EVENTS_H_ */
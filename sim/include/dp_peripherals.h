@@ -0,0 +1,64 @@
+/*
+ *  dp_peripherals.h
+ *
+ *  Description: Simulated DP peripheral base class.  A real DP peripheral streams packets
+ *  from dpserver; a simulated one is given a packet by the virtual clock every update
+ *  period and decodes it from the table-top model in its Handler().
+ */
+
+#ifndef DP_PERIPHERALS_H_
+#define DP_PERIPHERALS_H_
+
+#include "dp_events.h"
+#include "sim_world.h"
+#include "sim_replay.h"
+
+namespace DP
+{
+
+class Peripheral
+{
+	friend class EventContext;
+
+private:
+	unsigned updatePeriod;	// mS between packets
+	unsigned long dueTime;
+	bool isStreaming;
+
+protected:
+	EventContext& evtCtx;
+	Sim::World& world;
+	const char* slot;
+
+	Peripheral(EventContext& _evtCtx, const char* _slot, unsigned _updatePeriod) :
+		updatePeriod(_updatePeriod), dueTime(0), isStreaming(false),
+		evtCtx(_evtCtx), world(_evtCtx.GetWorld()), slot(_slot)
+	{}
+
+	void SetUpdatePeriod(unsigned period)
+	{
+		updatePeriod = period;
+	}
+
+	// decode the packet that just arrived
+	virtual void Handler() = 0;
+
+	// the recorded stream this peripheral's packets come from when replaying, if any
+	virtual int ReplayStream() const
+	{
+		return -1;
+	}
+
+public:
+	virtual ~Peripheral()
+	{}
+	void StartDataStream();
+	void StopDataStream()
+	{
+		isStreaming = false;
+	}
+};
+
+} // namespace DP
+
+#endif /* DP_PERIPHERALS_H_ */
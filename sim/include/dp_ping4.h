@@ -0,0 +1,51 @@
+/*
+ *  dp_ping4.h
+ *
+ *  Description: Simulated DP PING4 quad Parallax Ping))) interface.  Distances are in mm.
+ */
+
+#ifndef DP_PING4_H_
+#define DP_PING4_H_
+
+#include "dp_peripherals.h"
+
+namespace DP
+{
+
+class PING4 : public Peripheral
+{
+private:
+	static const unsigned UpdatePeriod = 50;
+	bool isEnabled[4];
+	unsigned distances[4];
+
+protected:
+	void Handler();
+	int ReplayStream() const
+	{
+		return Sim::Replay::RANGE;
+	}
+
+public:
+	enum SENSORS {SENSOR_0 = 0, SENSOR_1, SENSOR_2, SENSOR_3};
+	static const unsigned MinRange = 20;
+	static const unsigned MaxRange = 3000;
+
+	PING4(EventContext& evtCtx, const char* slot);
+	void Enable(int sensor)
+	{
+		isEnabled[sensor] = true;
+	}
+	void Disable(int sensor)
+	{
+		isEnabled[sensor] = false;
+	}
+	unsigned GetDistance(int sensor)
+	{
+		return distances[sensor];
+	}
+};
+
+} // namespace DP
+
+#endif /* DP_PING4_H_ */
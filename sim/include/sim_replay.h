@@ -0,0 +1,114 @@
+/*
+ *  sim_replay.h
+ *
+ *  Description: Deterministic replay of a flight recorder file through the simulated DP
+ *  backend.  Instead of sampling the table-top model, the ADC812, PING4 and COUNT4
+ *  peripherals are handed the recorded edge, range and encoder packets at their recorded
+ *  times, so the unmodified peripheral classes and controllers run on virtual time as fast
+ *  as the CPU allows.  The motor commands the controller emits are captured from the DC2
+ *  and diffed against the recorded ones.
+ *
+ *  The recorded shutdown request is made again at the end of the mS step it was recorded
+ *  in, after the packets recorded before it, see TakeShutdown(); the packets after it,
+ *  which confirm the stop, are still delivered and the replay ends with the last record.
+ *  A recording without one, of a mission that never shut down, is shut down at its end.
+ *
+ *  Motor commands are compared per motor as the sequence of changes to its (mode, power)
+ *  setting, power quantized to the recorder's 1/100 %, each with its time in mS.
+ *
+ *  The battery is not replayed; the VoltMeter keeps reading the model, which stands still.
+ */
+
+#ifndef SIM_REPLAY_H_
+#define SIM_REPLAY_H_
+
+#include <cstdio>
+#include <vector>
+#include "flight_recorder.h"
+
+namespace Sim
+{
+
+class Replay
+{
+public:
+	// the recorded packet streams, see DP::Peripheral::ReplayStream()
+	enum STREAM {EDGES = 0, RANGE, ODOMETRY, NUM_STREAMS};
+
+	// load a flight recorder file, exits if it cannot be read
+	Replay(const char* path);
+
+	// virtual time in mS of the last recorded record
+	unsigned long EndTime() const
+	{
+		return endTime;
+	}
+
+	// consume the next packet recorded at or before now, false if there is none or the
+	// recorded shutdown request comes first
+	bool NextPacket(unsigned long now, STREAM* pStream);
+
+	// true once, when NextPacket() has reached the recorded shutdown request
+	bool TakeShutdown()
+	{
+		bool isDue = isShutdownDue;
+		isShutdownDue = false;
+		return isDue;
+	}
+
+	// the contents of the last packet of each stream
+	unsigned GetEdge_mV(int sensor) const
+	{
+		return edge_mV[sensor];
+	}
+	unsigned GetDistance(int sensor) const
+	{
+		return distances[sensor];
+	}
+	unsigned GetCount(int side) const
+	{
+		return counts[side];
+	}
+	float GetInterval(int side) const
+	{
+		return intervals[side];
+	}
+
+	// a motor command written to the DC2 by the replayed program
+	void MotorCommand(unsigned long now, int motor, char mode, float power);
+
+	// diff the replayed motor commands against the recorded ones, true if they match
+	bool PrintDiff(FILE* fp) const;
+
+private:
+	struct Command
+	{
+		unsigned long time;
+		char mode;
+		int32_t power;		// 1/100 %
+	};
+
+	const char* path;
+	std::vector<FlightRecord> records;
+	size_t cursor;
+	uint64_t startTime_us;
+	unsigned long endTime;
+	unsigned long shutdownTime;		// of the first shutdown request, 0 if none
+	bool isWrapped;
+	bool isShutdownDue;
+
+	unsigned edge_mV[3];
+	unsigned distances[4];
+	unsigned counts[2];
+	float intervals[2];
+
+	std::vector<Command> recorded[2];
+	std::vector<Command> replayed[2];
+
+	unsigned long TimeOf(const FlightRecord& record) const;
+	static void AddCommand(std::vector<Command>& commands, unsigned long time, char mode, int32_t power);
+};
+
+} // namespace Sim
+
+#endif /* SIM_REPLAY_H_ */
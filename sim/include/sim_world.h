@@ -0,0 +1,199 @@
+/*
+ *  sim_world.h
+ *
+ *  Description: Kinematic model of jefebot on an HBRC table top used by the simulated
+ *  DP backend.  The world integrates the differential drive from the DC2 motor commands
+ *  and synthesizes what each peripheral would report:
+ *      - Count4 wheel encoder edges and edge times
+ *      - Sharp GP2Y0A21YK0F edge sensor voltages on the ADC812
+ *      - Ping))) echo distance to the object inside the sensor cone
+ *      - BB4IO button state
+ *      - battery voltage, including sag under motor load, on the MCP3008
+ *
+ *  Distances are in cm, angles in radians, time in seconds and voltages in volts
+ *  unless noted otherwise.  The world frame has its origin at a corner of the table
+ *  with x along the length and y along the width.
+ */
+
+#ifndef SIM_WORLD_H_
+#define SIM_WORLD_H_
+
+#include <stdint.h>
+#include <random>
+#include <vector>
+#include <atomic>
+
+namespace Sim
+{
+
+// simulation parameters, overridable from the environment
+struct Config
+{
+	double duration;		// mission length -- JEFEBOT_SIM_SECONDS
+	unsigned seed;			// sensor noise seed -- JEFEBOT_SIM_SEED
+	double stateOfCharge;	// initial battery charge, 0..1 -- JEFEBOT_SIM_SOC
+	double buttonTime;		// time that button S3 is pressed, < 0 for never -- JEFEBOT_SIM_BUTTON
+	double objectX;			// object location -- JEFEBOT_SIM_OBJECT="x,y"
+	double objectY;
+	const char* replayPath;	// flight record to replay, 0 for none -- JEFEBOT_SIM_REPLAY
+
+	Config();
+	void FromEnvironment();
+};
+
+struct Pose
+{
+	double x;
+	double y;
+	double theta;
+};
+
+class World
+{
+public:
+	// table, object and robot geometry
+	static constexpr double TableLength = 150.0;
+	static constexpr double TableWidth = 75.0;
+	static constexpr double TableHeight = 76.0;
+	static constexpr double ObjectRadius = 4.0;
+	static constexpr double WheelBase = 14.0;
+	static constexpr double TicksPerCM = 2.0;
+
+	// edge sensors look down and ahead of the bot: left, front and right footprints
+	static const int NumEdgeSensors = 3;
+	static constexpr double EdgeSensorRange = 12.0;
+
+	// Ping))) sensor mounted on the nose looking straight ahead
+	static const int NumPingSensors = 4;
+	static constexpr double PingConeHalfAngle = 0.35;
+	static constexpr double PingMaxRange = 300.0;
+
+	// motors
+	enum MOTOR {LEFT = 0, RIGHT};
+	enum MODE {FORWARD, REVERSE, BREAK, COAST};
+
+	World(const Config& config);
+
+	// the world the simulated peripherals are attached to
+	static World& Instance()
+	{
+		return *instance;
+	}
+
+	const Config& GetConfig() const
+	{
+		return config;
+	}
+
+	// advance the model by dt seconds
+	void Step(double dt);
+
+	// advance only the clock, e.g. while the sensors are replayed from a recording
+	void Tick(double dt)
+	{
+		time.store(time.load(std::memory_order_relaxed) + dt, std::memory_order_relaxed);
+	}
+
+	double Time() const
+	{
+		return time.load(std::memory_order_relaxed);
+	}
+
+	// tie the virtual time to CLOCK_MONOTONIC for a run in real time, the epoch in nS is
+	// the wall time of virtual time 0; WallTime_ns() is then the wall time of the current
+	// virtual time, and 0 when it is not tied
+	void SetWallEpoch(uint64_t epoch_ns)
+	{
+		wallEpoch_ns = epoch_ns;
+	}
+	uint64_t WallTime_ns() const
+	{
+		return wallEpoch_ns ? wallEpoch_ns + (uint64_t)(Time() * 1e9 + 0.5) : 0;
+	}
+
+	// actuators
+	void SetMotor(int motor, MODE mode, double power);
+
+	// sensors
+	unsigned GetEncoderEdges(int motor) const
+	{
+		return wheels[motor].edges;
+	}
+	double GetLastEdgeTime(int motor) const
+	{
+		return wheels[motor].lastEdgeTime;
+	}
+	double GetEdgeSensorVoltage(int sensor);
+	double GetPingDistance(int sensor);
+	double GetBatteryVoltage() const;
+	bool IsButtonPressed(unsigned mask) const;
+
+	// mission status
+	const Pose& GetPose() const
+	{
+		return pose;
+	}
+	bool HasFallen() const
+	{
+		return hasFallen;
+	}
+	double Odometer() const
+	{
+		return odometer;
+	}
+	double StateOfCharge() const
+	{
+		return stateOfCharge;
+	}
+
+	// ground truth time from an edge sensor footprint leaving the table, while driving
+	// forward, to both motors being commanded to BREAK
+	const std::vector<double>& EdgeToStopLatencies() const
+	{
+		return edgeToStopLatencies;
+	}
+
+	// a pseudo-random phase in [0, period) for a peripheral's data stream
+	unsigned StreamPhase(unsigned period);
+
+	// Sharp GP2Y0A21YK0F output voltage for a reflector at the given distance
+	static double SharpVoltage(double distance);
+
+private:
+	struct Wheel
+	{
+		MODE mode;
+		double power;		// DC2 power, 0..100 %
+		double gain;		// motor to motor mismatch
+		double velocity;	// cm/s, signed
+		double travel;		// total unsigned distance rolled
+		unsigned edges;		// encoder edges seen
+		double lastEdgeTime;
+	};
+
+	static World* instance;
+
+	Config config;
+	std::mt19937 rng;
+	std::normal_distribution<double> noise;
+	std::atomic<double> time;		// read from any thread, by MonotonicTime_us()
+	uint64_t wallEpoch_ns;
+	Pose pose;
+	Wheel wheels[2];
+	double stateOfCharge;
+	double current;
+	double odometer;
+	bool hasFallen;
+	bool isEdgeExposed;
+	double edgeExposedTime;
+	bool isAwaitingStop;
+	std::vector<double> edgeToStopLatencies;
+
+	bool IsOnTable(double x, double y) const;
+	bool IsEdgeExposed() const;
+	void ToWorld(double bx, double by, double* px, double* py) const;
+};
+
+} // namespace Sim
+
+#endif /* SIM_WORLD_H_ */
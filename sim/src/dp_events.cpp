@@ -0,0 +1,147 @@
+/*
+ *  dp_events.cpp
+ *
+ *  Description: Simulated DP event loop.  The loop advances the table-top model in 1 mS
+ *  steps of virtual time, delivers a packet to each streaming peripheral whose update
+ *  period has elapsed, then runs each periodic callback that is due.  Nothing ever waits
+ *  on a real clock, unless the loop is set to run in real time.
+ *
+ *  The program entry point is in sim_main.cpp, so that other programs, e.g. the
+ *  benchmarks, can run the event loop from their own main().
+ */
+
+#include <ctime>
+#include <sys/prctl.h>
+#include "dp_events.h"
+#include "dp_peripherals.h"
+#include "sim_world.h"
+#include "sim_replay.h"
+
+namespace DP
+{
+
+EventContext::EventContext(Sim::World& _world, Sim::Replay* _replay) :
+	world(_world), replay(_replay), now(0), isRealTime(false), wallEpoch_ns(0)
+{
+}
+
+void EventContext::SetRealTime(bool _isRealTime)
+{
+	struct timespec ts;
+
+	if (_isRealTime && replay)
+	{
+		throw FrameworkException("EventContext", ERR_PARAMS);
+	}
+
+	// the packets are due to the uS, not to the default 50 uS of timer slack
+	if (_isRealTime)
+		prctl(PR_SET_TIMERSLACK, 1);
+
+	// the virtual time carries on from where it is
+	isRealTime = _isRealTime;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	wallEpoch_ns = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec - (uint64_t)now * 1000000;
+	world.SetWallEpoch(isRealTime ? wallEpoch_ns : 0);
+}
+
+// sleep until the next mS is due, then apply the motor commands sent during this one
+void EventContext::AwaitRealTime()
+{
+	uint64_t due_ns = wallEpoch_ns + (uint64_t)(now + 1) * 1000000;
+	struct timespec due;
+	MotorCommand command;
+
+	due.tv_sec = due_ns / 1000000000;
+	due.tv_nsec = due_ns % 1000000000;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, 0) != 0)
+		;
+
+	while (motorCommands.Pop(&command))
+		world.SetMotor(command.motor, (Sim::World::MODE)command.mode, command.power);
+}
+
+void EventContext::Register(Callback* callback)
+{
+	if (!callback)
+	{
+		throw FrameworkException("EventContext", ERR_REGISTRATION);
+	}
+	callback->dueTime = now + callback->period;
+	callbacks.push_back(callback);
+}
+
+void EventContext::Register(Peripheral* peripheral)
+{
+	if (!peripheral)
+	{
+		throw FrameworkException("EventContext", ERR_REGISTRATION);
+	}
+	peripherals.push_back(peripheral);
+}
+
+void EventContext::DeliverReplay()
+{
+	Sim::Replay::STREAM stream;
+
+	while (replay->NextPacket(now, &stream))
+	{
+		for (size_t i = 0; i < peripherals.size(); ++i)
+		{
+			Peripheral* p = peripherals[i];
+			if (p->isStreaming && p->ReplayStream() == stream)
+				p->Handler();
+		}
+	}
+}
+
+void EventContext::Run(unsigned long endTime)
+{
+	while (now < endTime && !world.HasFallen())
+	{
+		if (isRealTime)
+			AwaitRealTime();
+
+		// the model stands still while replaying, only its clock moves
+		if (replay)
+			world.Tick(0.001);
+		else
+			world.Step(0.001);
+		++now;
+
+		// recorded packets are delivered to the peripherals they were recorded from
+		if (replay)
+			DeliverReplay();
+
+		// sensor packets arrive before the callbacks that consume them
+		for (size_t i = 0; i < peripherals.size(); ++i)
+		{
+			Peripheral* p = peripherals[i];
+			bool isRecorded = replay && p->ReplayStream() >= 0;
+			if (p->isStreaming && !isRecorded && now >= p->dueTime)
+			{
+				p->dueTime += p->updatePeriod;
+				p->Handler();
+			}
+		}
+		for (size_t i = 0; i < callbacks.size(); ++i)
+		{
+			Callback* c = callbacks[i];
+			if (now >= c->dueTime)
+			{
+				c->dueTime += c->period;
+				c->Routine();
+			}
+		}
+
+		// a recorded shutdown request is made again at the end of its step, where the
+		// simulated mission makes its own, and the packets recorded after it follow
+		if (replay && replay->TakeShutdown())
+		{
+			Shutdown("sim: recorded shutdown replayed", ERR_NONE);
+			DeliverReplay();
+		}
+	}
+}
+
+} // namespace DP
@@ -0,0 +1,210 @@
+/*
+ *  dp_peripherals.cpp
+ *
+ *  Description: Implementation of the simulated DP peripherals.  Each Handler() decodes
+ *  a "packet" by sampling the table-top model at the current virtual time, or when
+ *  replaying takes the recorded one.
+ */
+
+#include <cmath>
+#include "dp_peripherals.h"
+#include "dp_bb4io.h"
+#include "dp_dc2.h"
+#include "dp_count4.h"
+#include "dp_ping4.h"
+#include "dp_adc812.h"
+
+namespace DP
+{
+
+void Peripheral::StartDataStream()
+{
+	// dpserver streams are not in phase with the control program's timers
+	isStreaming = true;
+	dueTime = evtCtx.Now() + updatePeriod + world.StreamPhase(updatePeriod);
+}
+
+BB4IO::BB4IO(EventContext& evtCtx) : Peripheral(evtCtx, "1", UpdatePeriod), buttons(0), leds(0)
+{
+}
+
+void BB4IO::Handler()
+{
+	buttons = 0;
+	for (unsigned mask = S1; mask <= S3; mask <<= 1)
+	{
+		if (world.IsButtonPressed(mask))
+			buttons |= mask;
+	}
+}
+
+DC2::DC2(EventContext& _evtCtx, const char* _slot) :
+	evtCtx(_evtCtx), world(_evtCtx.GetWorld()), slot(_slot), watchdog(0)
+{
+	modes[0] = modes[1] = BREAK;
+	powers[0] = powers[1] = 0.0;
+}
+
+void DC2::Apply(int motor)
+{
+	Sim::World::MODE mode;
+
+	if (evtCtx.GetReplay())
+	{
+		evtCtx.GetReplay()->MotorCommand(evtCtx.Now(), motor, modes[motor], powers[motor]);
+		return;
+	}
+
+	switch (modes[motor])
+	{
+		case FORWARD:	mode = Sim::World::FORWARD;	break;
+		case REVERSE:	mode = Sim::World::REVERSE;	break;
+		case COAST:		mode = Sim::World::COAST;	break;
+		default:		mode = Sim::World::BREAK;	break;
+	}
+
+	// in real time the command goes to dpserver, which applies it on its own time
+	if (evtCtx.IsRealTime())
+	{
+		EventContext::MotorCommand command = {motor, mode, powers[motor]};
+		if (!evtCtx.QueueMotorCommand(command))
+		{
+			throw FrameworkException("DC2", ERR_WRITE);
+		}
+		return;
+	}
+	world.SetMotor(motor, mode, powers[motor]);
+}
+
+void DC2::SetMode0(char mode)
+{
+	modes[0] = mode;
+	Apply(0);
+}
+
+void DC2::SetMode1(char mode)
+{
+	modes[1] = mode;
+	Apply(1);
+}
+
+void DC2::SetPower0(float power)
+{
+	powers[0] = power;
+	Apply(0);
+}
+
+void DC2::SetPower1(float power)
+{
+	powers[1] = power;
+	Apply(1);
+}
+
+COUNT4::COUNT4(EventContext& evtCtx, const char* slot) : Peripheral(evtCtx, slot, DefaultUpdatePeriod)
+{
+	for (int i = 0; i < 4; ++i)
+	{
+		edgeModes[i] = DISABLE_EDGE;
+		counts[i] = 0;
+		intervals[i] = 0.0;
+	}
+	for (int i = 0; i < 2; ++i)
+	{
+		reportedEdges[i] = world.GetEncoderEdges(i);
+		reportedEdgeTimes[i] = world.GetLastEdgeTime(i);
+	}
+}
+
+void COUNT4::SetEdges(int edges0, int edges1, int edges2, int edges3)
+{
+	edgeModes[0] = edges0;
+	edgeModes[1] = edges1;
+	edgeModes[2] = edges2;
+	edgeModes[3] = edges3;
+}
+
+void COUNT4::Handler()
+{
+	if (evtCtx.GetReplay())
+	{
+		for (int i = 0; i < 2; ++i)
+		{
+			counts[i] = evtCtx.GetReplay()->GetCount(i);
+			intervals[i] = evtCtx.GetReplay()->GetInterval(i);
+		}
+		return;
+	}
+
+	// only the two encoder inputs are wired
+	for (int i = 0; i < 2; ++i)
+	{
+		unsigned edges = world.GetEncoderEdges(i);
+		double edgeTime = world.GetLastEdgeTime(i);
+		unsigned count = edges - reportedEdges[i];
+
+		if (edgeModes[i] == DISABLE_EDGE)
+			count = 0;
+		else if (edgeModes[i] != BOTH_EDGES)
+			count /= 2;
+
+		counts[i] = count;
+		intervals[i] = count ? (edgeTime - reportedEdgeTimes[i]) : 0.0;
+		reportedEdges[i] = edges;
+		reportedEdgeTimes[i] = edgeTime;
+	}
+}
+
+PING4::PING4(EventContext& evtCtx, const char* slot) : Peripheral(evtCtx, slot, UpdatePeriod)
+{
+	for (int i = 0; i < 4; ++i)
+	{
+		isEnabled[i] = false;
+		distances[i] = MaxRange;
+	}
+}
+
+void PING4::Handler()
+{
+	for (int i = 0; i < 4; ++i)
+	{
+		if (isEnabled[i] && evtCtx.GetReplay())
+		{
+			distances[i] = evtCtx.GetReplay()->GetDistance(i);
+		}
+		else if (isEnabled[i])
+		{
+			unsigned distance = (unsigned)(world.GetPingDistance(i) * 10.0);
+			distances[i] = (distance < MaxRange) ? distance : MaxRange;
+		}
+	}
+}
+
+ADC812::ADC812(EventContext& evtCtx, const char* slot) : Peripheral(evtCtx, slot, DefaultUpdatePeriod)
+{
+	for (int i = 0; i < 8; ++i)
+		samples[i] = 0;
+}
+
+void ADC812::Handler()
+{
+	if (evtCtx.GetReplay())
+	{
+		for (int i = 0; i < Sim::World::NumEdgeSensors; ++i)
+			samples[CHANNEL_1 + i] = evtCtx.GetReplay()->GetEdge_mV(i);
+		return;
+	}
+
+	// quantize the edge sensor voltages to 12 bits
+	for (int i = 0; i < Sim::World::NumEdgeSensors; ++i)
+	{
+		double volts = world.GetEdgeSensorVoltage(i);
+		long code = lround(volts * 1000.0 * MaxCode / FullScale_mV);
+		if (code < 0)
+			code = 0;
+		if (code > (long)MaxCode)
+			code = MaxCode;
+		samples[CHANNEL_1 + i] = (code * FullScale_mV) / MaxCode;
+	}
+}
+
+} // namespace DP
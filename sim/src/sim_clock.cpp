@@ -0,0 +1,28 @@
+/*
+ *  sim_clock.cpp
+ *
+ *  Description: Simulated monotonic time source, the virtual time of the table-top model.
+ *  A packet arrives at the wall time of the virtual time it is delivered at, when the
+ *  event loop runs in real time.
+ */
+
+#include <cmath>
+#include <ctime>
+#include "clock.h"
+#include "sim_world.h"
+
+uint64_t MonotonicTime_us()
+{
+	return (uint64_t)llround(Sim::World::Instance().Time() * 1e6);
+}
+
+uint64_t PacketArrival_ns()
+{
+	uint64_t wall_ns = Sim::World::Instance().WallTime_ns();
+	struct timespec ts;
+
+	if (wall_ns)
+		return wall_ns;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
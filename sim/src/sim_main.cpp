@@ -0,0 +1,89 @@
+/*
+ *  sim_main.cpp
+ *
+ *  Description: Program entry point of the simulated DP backend.  The simulation is
+ *  configured from the environment, see Sim::Config, and the control program's own
+ *  options are passed through untouched.  With JEFEBOT_SIM_REPLAY set the sensors are
+ *  replayed from a flight record instead, see sim_replay.h, which the threaded control
+ *  program cannot run on.  The outcome of the mission is printed whenever the program
+ *  exits once it has started.
+ */
+
+#include <ctime>
+#include <algorithm>
+#include "dp_events.h"
+#include "sim_world.h"
+#include "sim_replay.h"
+
+static Sim::World* world;
+static Sim::Replay* replay;
+static struct timespec wallStart;
+
+// report the outcome of the mission whenever the program exits
+static void PrintSummary()
+{
+	struct timespec wallEnd;
+	clock_gettime(CLOCK_MONOTONIC, &wallEnd);
+	double wall = (wallEnd.tv_sec - wallStart.tv_sec) + (wallEnd.tv_nsec - wallStart.tv_nsec) / 1e9;
+	const Sim::Pose& pose = world->GetPose();
+
+	printf("sim: %.1f s simulated in %.3f s (%.0fx real time)\n", world->Time(), wall, world->Time() / wall);
+
+	// a replay is judged by its motor commands, a divergence fails the run
+	if (replay)
+	{
+		if (!replay->PrintDiff(stdout))
+		{
+			fflush(stdout);
+			_exit(EXIT_FAILURE);
+		}
+		return;
+	}
+
+	printf("sim: odometer %.1f cm, pose (%.1f, %.1f, %.2f), battery %.2f V, %s\n",
+		world->Odometer(), pose.x, pose.y, pose.theta, world->GetBatteryVoltage(),
+		world->HasFallen() ? "FELL OFF THE TABLE" : "still on the table");
+
+	std::vector<double> latencies = world->EdgeToStopLatencies();
+	if (!latencies.empty())
+	{
+		std::sort(latencies.begin(), latencies.end());
+		size_t n = latencies.size();
+		printf("sim: edge to stop latency over %zu edges: min %.0f  p50 %.0f  p90 %.0f  max %.0f mS\n",
+			n, latencies[0] * 1e3, latencies[n / 2] * 1e3, latencies[(n * 9) / 10] * 1e3, latencies[n - 1] * 1e3);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	Sim::Config config;
+	config.FromEnvironment();
+
+	static Sim::World simWorld(config);
+	if (config.replayPath)
+		replay = new Sim::Replay(config.replayPath);
+	static DP::EventContext evtCtx(simWorld, replay);
+	world = &simWorld;
+
+	clock_gettime(CLOCK_MONOTONIC, &wallStart);
+
+	// a replay ends with its recording, whatever the mission length; its recorded shutdown
+	// is made again along the way
+	unsigned long endTime = replay ? replay->EndTime() : (unsigned long)(config.duration * 1000);
+
+	// the options are checked first, a mission never started has nothing to report
+	InitControlProgram(argc, argv, evtCtx);
+	atexit(PrintSummary);
+	evtCtx.Run(endTime);
+
+	if (simWorld.HasFallen())
+	{
+		printf("sim: jefebot fell off the table\n");
+		exit(EXIT_FAILURE);
+	}
+	// the control program finishes shutting down from the event loop once the motors stop
+	Shutdown(replay ? "sim: replay complete" : "sim: mission time elapsed", ERR_NONE);
+	evtCtx.Run(evtCtx.Now() + 1000);
+
+	return 0;
+}
@@ -0,0 +1,215 @@
+/*
+ *  sim_replay.cpp
+ *
+ *  Description: Implementation of the flight recorder replay used by the simulated DP
+ *  backend.
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "sim_replay.h"
+
+namespace Sim
+{
+
+static const char* MotorNames[2] = {"left", "right"};
+
+Replay::Replay(const char* _path) :
+	path(_path), cursor(0), startTime_us(0), endTime(0), shutdownTime(0), isWrapped(false), isShutdownDue(false)
+{
+	int fd;
+	struct stat st;
+	void* map = MAP_FAILED;
+
+	for (int i = 0; i < 3; ++i)
+		edge_mV[i] = 0;
+	for (int i = 0; i < 4; ++i)
+		distances[i] = 0;
+	for (int i = 0; i < 2; ++i)
+	{
+		counts[i] = 0;
+		intervals[i] = 0.0;
+	}
+
+	if ((fd = open(path, O_RDONLY)) >= 0)
+	{
+		if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(FlightRecorderHeader))
+			map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+	}
+	if (map == MAP_FAILED || !((const FlightRecorderHeader*)map)->IsValid(st.st_size))
+	{
+		fprintf(stderr, "sim: cannot replay %s, it is not a version %u flight recorder file\n",
+			path, FlightRecorderHeader::Version);
+		exit(EXIT_FAILURE);
+	}
+
+	// copy the ring out oldest first
+	const FlightRecorderHeader* header = (const FlightRecorderHeader*)map;
+	const FlightRecord* ring = (const FlightRecord*)(header + 1);
+	uint64_t head = header->head.load(std::memory_order_acquire);
+	uint64_t first = (head > header->capacity) ? head - header->capacity : 0;
+
+	startTime_us = header->startTime_us;
+	isWrapped = (first != 0);
+	records.reserve(head - first);
+	for (uint64_t n = first; n < head; ++n)
+	{
+		const FlightRecord& r = ring[n % header->capacity];
+		if (r.type != FR_NONE && r.type < FR_NUM_TYPES)
+			records.push_back(r);
+	}
+	munmap(map, st.st_size);
+
+	if (!records.empty())
+		endTime = TimeOf(records.back());
+	for (size_t i = 0; i < records.size() && shutdownTime == 0; ++i)
+	{
+		if (records[i].type == FR_SHUTDOWN)
+			shutdownTime = TimeOf(records[i]);
+	}
+
+	// the recorded motor settings as they changed, starting from the DC2's stopped state
+	char modes[2] = {'b', 'b'};
+	int32_t powers[2] = {0, 0};
+	for (size_t i = 0; i < records.size(); ++i)
+	{
+		const FlightRecord& r = records[i];
+		if (r.type != FR_MOTOR_MODE && r.type != FR_MOTOR_POWER)
+			continue;
+		for (int m = 0; m < 2; ++m)
+		{
+			if (r.type == FR_MOTOR_MODE)
+				modes[m] = r.values[m];
+			else
+				powers[m] = r.values[m];
+			AddCommand(recorded[m], TimeOf(r), modes[m], powers[m]);
+		}
+	}
+
+	if (isWrapped)
+	{
+		fprintf(stderr, "sim: %s has wrapped, the replay starts part way through the mission\n", path);
+	}
+}
+
+unsigned long Replay::TimeOf(const FlightRecord& record) const
+{
+	// packets are delivered on the first 1 mS step at or after their arrival
+	return (record.time_us - startTime_us + 999) / 1000;
+}
+
+bool Replay::NextPacket(unsigned long now, STREAM* pStream)
+{
+	while (cursor < records.size() && TimeOf(records[cursor]) <= now)
+	{
+		const FlightRecord& r = records[cursor++];
+
+		switch (r.type)
+		{
+			case FR_EDGES:
+				for (int i = 0; i < 3; ++i)
+					edge_mV[i] = r.values[i];
+				*pStream = EDGES;
+				return true;
+
+			case FR_RANGE:
+				// the sensors fired together are in one PING4 packet, recorded back to back
+				distances[r.source] = r.values[0];
+				if (
+					cursor < records.size() && records[cursor].type == FR_RANGE &&
+					records[cursor].time_us == r.time_us
+				)
+				{
+					continue;
+				}
+				*pStream = RANGE;
+				return true;
+
+			case FR_ODOMETRY:
+				// both wheels are in one COUNT4 packet, recorded back to back
+				counts[r.source] = r.values[0];
+				memcpy(&intervals[r.source], &r.values[1], sizeof(float));
+				if (
+					cursor < records.size() && records[cursor].type == FR_ODOMETRY &&
+					records[cursor].time_us == r.time_us
+				)
+				{
+					continue;
+				}
+				*pStream = ODOMETRY;
+				return true;
+
+			case FR_SHUTDOWN:
+				// the packets after it wait until the request has been made
+				isShutdownDue = true;
+				return false;
+
+			default:
+				// everything else is an output of the program being replayed
+				break;
+		}
+	}
+
+	return false;
+}
+
+void Replay::AddCommand(std::vector<Command>& commands, unsigned long time, char mode, int32_t power)
+{
+	if (commands.empty() ? (mode == 'b' && power == 0) : (commands.back().mode == mode && commands.back().power == power))
+		return;
+
+	Command command = {time, mode, power};
+	commands.push_back(command);
+}
+
+void Replay::MotorCommand(unsigned long now, int motor, char mode, float power)
+{
+	AddCommand(replayed[motor], now, mode, (int32_t)(power * 100));
+}
+
+bool Replay::PrintDiff(FILE* fp) const
+{
+	bool isMatch = true;
+
+	fprintf(fp, "replay: %zu records over %.3f s from %s\n", records.size(), endTime / 1e3, path);
+	if (shutdownTime)
+		fprintf(fp, "replay: shutdown requested at %.3f s\n", shutdownTime / 1e3);
+	else
+		fprintf(fp, "replay: no shutdown recorded, shut down at the end of the recording\n");
+	for (int m = 0; m < 2; ++m)
+	{
+		const std::vector<Command>& a = recorded[m];
+		const std::vector<Command>& b = replayed[m];
+		size_t n = 0;
+
+		while (n < a.size() && n < b.size() && a[n].time == b[n].time && a[n].mode == b[n].mode && a[n].power == b[n].power)
+			++n;
+
+		if (n == a.size() && n == b.size())
+		{
+			fprintf(fp, "replay: %s motor: all %zu commands match\n", MotorNames[m], n);
+			continue;
+		}
+
+		isMatch = false;
+		fprintf(fp, "replay: %s motor: %zu of %zu recorded commands match, then diverges at command %zu\n",
+			MotorNames[m], n, a.size(), n);
+		if (n < a.size())
+			fprintf(fp, "replay:     recorded '%c' %6.2f %% at %.3f s\n", a[n].mode, a[n].power / 1e2, a[n].time / 1e3);
+		else
+			fprintf(fp, "replay:     recorded nothing more\n");
+		if (n < b.size())
+			fprintf(fp, "replay:     replayed '%c' %6.2f %% at %.3f s\n", b[n].mode, b[n].power / 1e2, b[n].time / 1e3);
+		else
+			fprintf(fp, "replay:     replayed nothing more\n");
+	}
+
+	return isMatch;
+}
+
+} // namespace Sim
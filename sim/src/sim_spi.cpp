@@ -0,0 +1,59 @@
+/*
+ *  sim_spi.cpp
+ *
+ *  Description: Simulated spidev transport.  Models an MCP3008 on /dev/spidev0.0 with the
+ *  battery, through a 4:1 divider, on channel 7 and the remaining channels grounded.
+ */
+
+#include <cstring>
+#include "spi.h"
+#include "sim_world.h"
+
+static const int SimFd = 1000;
+static const double VRef = 3.3;
+
+static uint8_t Reverse(uint8_t b)
+{
+	b = ((b & 0xf0) >> 4) | ((b & 0x0f) << 4);
+	b = ((b & 0xcc) >> 2) | ((b & 0x33) << 2);
+	b = ((b & 0xaa) >> 1) | ((b & 0x55) << 1);
+	return b;
+}
+
+int SPIOpen(const char *dev, uint8_t mode, uint8_t bits, uint32_t speed)
+{
+	return (strcmp(dev, "/dev/spidev0.0") == 0) ? SimFd : -1;
+}
+
+int SPITransfer(int fd, struct spi_ioc_transfer *tr, unsigned count)
+{
+	if (fd != SimFd || count == 0)
+		return -1;
+
+	for (unsigned i = 0; i < count; ++i)
+	{
+		const uint8_t *out = (const uint8_t *)(unsigned long)tr[i].tx_buf;
+		uint8_t *in = (uint8_t *)(unsigned long)tr[i].rx_buf;
+		unsigned channel = (out[0] >> 3) & 0x07;
+		unsigned code = 0;
+
+		if (tr[i].len != 4)
+			return -1;
+
+		if (channel == 7)
+		{
+			double volts = Sim::World::Instance().GetBatteryVoltage() / 4;
+			code = (unsigned)(volts * 1024 / VRef);
+			if (code > 1023)
+				code = 1023;
+		}
+
+		// the 10-bit result MSB first, followed by the LSB first repeat of it
+		in[0] = 0;
+		in[1] = code >> 2;
+		in[2] = Reverse(code & 0xff);
+		in[3] = Reverse((code >> 8) & 0x03);
+	}
+
+	return 0;
+}
@@ -0,0 +1,288 @@
+/*
+ *  sim_world.cpp
+ *
+ *  Description: Implementation of the table-top model used by the simulated DP backend.
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include "sim_world.h"
+
+namespace Sim
+{
+
+// motor model: wheel speed is proportional to power above a deadband and to the
+// battery voltage, with a first order lag that is much quicker when braking
+static constexpr double MaxWheelSpeed = 50.0;
+static constexpr double MotorDeadband = 10.0;
+static constexpr double NominalVoltage = 12.0;
+static constexpr double DriveTimeConstant = 0.10;
+static constexpr double BreakTimeConstant = 0.02;
+static constexpr double CoastTimeConstant = 0.30;
+
+// battery model: 3 cell LiPo with a typical discharge curve and internal resistance
+static constexpr double BatteryCapacity = 1.0 * 3600.0;	// 1 Ah in As
+static constexpr int BatteryCells = 3;
+// resting cell voltage by state of charge, in steps of 10%
+static const double CellCurve[] = {3.30, 3.69, 3.73, 3.77, 3.80, 3.84, 3.87, 3.95, 4.02, 4.11, 4.20};
+static const int CellCurveLength = sizeof(CellCurve) / sizeof(CellCurve[0]);
+static constexpr double InternalResistance = 0.3;
+static constexpr double IdleCurrent = 0.25;
+static constexpr double StallCurrent = 1.5;
+
+// edge sensor footprints in the bot frame (x forward, y left)
+static const double EdgeSensorFootprint[World::NumEdgeSensors][2] =
+{
+	{9.0, 6.0},		// LEFT
+	{11.0, 0.0},	// FRONT
+	{9.0, -6.0}		// RIGHT
+};
+static constexpr double EdgeSensorNoise = 0.02;
+
+// Ping))) sensor mounting angles relative to the bot heading, sensor 0 is the nose
+static const double PingMountAngle[World::NumPingSensors] = {0.0, 0.8, -0.8, M_PI};
+static constexpr double PingOffset = 6.0;
+
+// Sharp GP2Y0A21YK0F datasheet curve (cm, V) for a white reflector
+static const double SharpCurve[][2] =
+{
+	{6.0, 3.10}, {7.0, 3.00}, {8.0, 2.75}, {10.0, 2.30}, {15.0, 1.65}, {20.0, 1.30},
+	{25.0, 1.08}, {30.0, 0.92}, {40.0, 0.75}, {50.0, 0.60}, {60.0, 0.50}, {70.0, 0.45},
+	{80.0, 0.40}
+};
+static const int SharpCurveLength = sizeof(SharpCurve) / sizeof(SharpCurve[0]);
+
+World* World::instance = 0;
+
+Config::Config() :
+	duration(300.0), seed(1), stateOfCharge(0.9), buttonTime(-1.0),
+	objectX(110.0), objectY(50.0), replayPath(0)
+{
+}
+
+void Config::FromEnvironment()
+{
+	const char* value;
+
+	if ((value = getenv("JEFEBOT_SIM_SECONDS")))
+		duration = atof(value);
+	if ((value = getenv("JEFEBOT_SIM_SEED")))
+		seed = atoi(value);
+	if ((value = getenv("JEFEBOT_SIM_SOC")))
+		stateOfCharge = atof(value);
+	if ((value = getenv("JEFEBOT_SIM_BUTTON")))
+		buttonTime = atof(value);
+	if ((value = getenv("JEFEBOT_SIM_OBJECT")))
+		sscanf(value, "%lf,%lf", &objectX, &objectY);
+	if ((value = getenv("JEFEBOT_SIM_REPLAY")))
+		replayPath = value;
+}
+
+World::World(const Config& _config) :
+	config(_config), rng(_config.seed), noise(0.0, 1.0), time(0.0), wallEpoch_ns(0),
+	stateOfCharge(_config.stateOfCharge), current(IdleCurrent), odometer(0.0), hasFallen(false),
+	isEdgeExposed(false), edgeExposedTime(0.0), isAwaitingStop(false)
+{
+	// start in the middle of the table facing along its length
+	pose.x = TableLength / 2;
+	pose.y = TableWidth / 2;
+	pose.theta = 0.0;
+
+	for (int i = 0; i < 2; ++i)
+	{
+		wheels[i].mode = BREAK;
+		wheels[i].power = 0.0;
+		wheels[i].gain = (i == LEFT) ? 1.0 : 0.94;
+		wheels[i].velocity = 0.0;
+		wheels[i].travel = 0.0;
+		wheels[i].edges = 0;
+		wheels[i].lastEdgeTime = 0.0;
+	}
+
+	instance = this;
+}
+
+void World::SetMotor(int motor, MODE mode, double power)
+{
+	wheels[motor].mode = mode;
+	wheels[motor].power = power;
+
+	if (isAwaitingStop && wheels[LEFT].mode == BREAK && wheels[RIGHT].mode == BREAK)
+	{
+		edgeToStopLatencies.push_back(time - edgeExposedTime);
+		isAwaitingStop = false;
+	}
+}
+
+unsigned World::StreamPhase(unsigned period)
+{
+	return period ? rng() % period : 0;
+}
+
+void World::Step(double dt)
+{
+	double batteryVoltage = GetBatteryVoltage();
+
+	// motor dynamics and encoders
+	current = IdleCurrent;
+	for (int i = 0; i < 2; ++i)
+	{
+		Wheel& w = wheels[i];
+		double target = 0.0;
+		double tau = CoastTimeConstant;
+
+		if (w.mode == FORWARD || w.mode == REVERSE)
+		{
+			double drive = (w.power - MotorDeadband) / (100.0 - MotorDeadband);
+			if (drive < 0.0)
+				drive = 0.0;
+			target = w.gain * MaxWheelSpeed * drive * (batteryVoltage / NominalVoltage);
+			if (w.mode == REVERSE)
+				target = -target;
+			tau = DriveTimeConstant;
+			current += StallCurrent * w.power / 100.0;
+		}
+		else if (w.mode == BREAK)
+		{
+			tau = BreakTimeConstant;
+		}
+		w.velocity += (target - w.velocity) * (dt / (tau + dt));
+
+		// emit encoder edges, timestamped where they fall inside the step
+		double delta = fabs(w.velocity) * dt;
+		double prevTravel = w.travel;
+		w.travel += delta;
+		unsigned edges = (unsigned)(w.travel * TicksPerCM);
+		if (edges != w.edges)
+		{
+			double lastEdgeAt = edges / TicksPerCM;
+			w.lastEdgeTime = time + dt * (lastEdgeAt - prevTravel) / delta;
+			w.edges = edges;
+		}
+	}
+
+	// differential drive kinematics
+	double v = (wheels[LEFT].velocity + wheels[RIGHT].velocity) / 2;
+	double omega = (wheels[RIGHT].velocity - wheels[LEFT].velocity) / WheelBase;
+	pose.x += v * cos(pose.theta + omega * dt / 2) * dt;
+	pose.y += v * sin(pose.theta + omega * dt / 2) * dt;
+	pose.theta = remainder(pose.theta + omega * dt, 2 * M_PI);
+	odometer += fabs(v) * dt;
+
+	// battery drain
+	stateOfCharge -= current * dt / BatteryCapacity;
+	if (stateOfCharge < 0.0)
+		stateOfCharge = 0.0;
+
+	Tick(dt);
+
+	// the bot falls once its center is over the edge
+	if (!IsOnTable(pose.x, pose.y))
+		hasFallen = true;
+
+	// start the edge to stop clock when a sensor first sees over the edge driving forward,
+	// i.e. with both wheels turning forward rather than spinning in place
+	bool isExposed = IsEdgeExposed();
+	if (isExposed && !isEdgeExposed && wheels[LEFT].velocity > 0.0 && wheels[RIGHT].velocity > 0.0 && !isAwaitingStop)
+	{
+		edgeExposedTime = time;
+		isAwaitingStop = true;
+	}
+	isEdgeExposed = isExposed;
+}
+
+double World::GetEdgeSensorVoltage(int sensor)
+{
+	double x, y;
+	double distance;
+
+	ToWorld(EdgeSensorFootprint[sensor][0], EdgeSensorFootprint[sensor][1], &x, &y);
+	distance = IsOnTable(x, y) ? EdgeSensorRange : EdgeSensorRange + TableHeight;
+
+	return SharpVoltage(distance) + EdgeSensorNoise * noise(rng);
+}
+
+double World::GetPingDistance(int sensor)
+{
+	double sx, sy;
+	double heading = pose.theta + PingMountAngle[sensor];
+
+	sx = pose.x + PingOffset * cos(heading);
+	sy = pose.y + PingOffset * sin(heading);
+
+	// the object is seen if any part of it is inside the cone
+	double dx = config.objectX - sx;
+	double dy = config.objectY - sy;
+	double range = sqrt(dx * dx + dy * dy);
+	if (range > ObjectRadius)
+	{
+		double offAxis = fabs(remainder(atan2(dy, dx) - heading, 2 * M_PI));
+		double halfWidth = asin(ObjectRadius / range);
+		if (offAxis - halfWidth < PingConeHalfAngle && range - ObjectRadius < PingMaxRange)
+		{
+			return range - ObjectRadius;
+		}
+	}
+
+	return PingMaxRange;
+}
+
+double World::GetBatteryVoltage() const
+{
+	double x = stateOfCharge * (CellCurveLength - 1);
+	int i = (x < CellCurveLength - 1) ? (int)x : CellCurveLength - 2;
+	double ocv = BatteryCells * (CellCurve[i] + (x - i) * (CellCurve[i + 1] - CellCurve[i]));
+	return ocv - current * InternalResistance;
+}
+
+bool World::IsButtonPressed(unsigned mask) const
+{
+	// only the shutdown button, S3, is ever pressed
+	return (mask & 0x04) && config.buttonTime >= 0.0 && time >= config.buttonTime;
+}
+
+double World::SharpVoltage(double distance)
+{
+	if (distance <= SharpCurve[0][0])
+		return SharpCurve[0][1];
+
+	for (int i = 1; i < SharpCurveLength; ++i)
+	{
+		if (distance <= SharpCurve[i][0])
+		{
+			double f = (distance - SharpCurve[i-1][0]) / (SharpCurve[i][0] - SharpCurve[i-1][0]);
+			return SharpCurve[i-1][1] + f * (SharpCurve[i][1] - SharpCurve[i-1][1]);
+		}
+	}
+
+	return SharpCurve[SharpCurveLength - 1][1];
+}
+
+bool World::IsOnTable(double x, double y) const
+{
+	return (0.0 <= x && x <= TableLength && 0.0 <= y && y <= TableWidth);
+}
+
+bool World::IsEdgeExposed() const
+{
+	for (int i = 0; i < NumEdgeSensors; ++i)
+	{
+		double x, y;
+		ToWorld(EdgeSensorFootprint[i][0], EdgeSensorFootprint[i][1], &x, &y);
+		if (!IsOnTable(x, y))
+			return true;
+	}
+	return false;
+}
+
+void World::ToWorld(double bx, double by, double* px, double* py) const
+{
+	double c = cos(pose.theta);
+	double s = sin(pose.theta);
+
+	*px = pose.x + bx * c - by * s;
+	*py = pose.y + bx * s + by * c;
+}
+
+} // namespace Sim
@@ -5,15 +5,61 @@
  */
 
 #include <stdint.h>
-#include <sys/fcntl.h>
-#include <sys/ioctl.h>
-#include <linux/spi/spidev.h>
+#include <cstring>
 #include "adc.h"
 
-ADC::ADC(unsigned _period) : GenericSensor(_period), spiDevId(SPI_DEV_0)
+// The MCP3008 result is decoded from the LSB first copy of it that follows the MSB first
+// one: byte 2 holds bits 0-7 in reverse order and the top 2 bits of byte 3 hold bits 8
+// and 9, also reversed.  Both are looked up in tables generated at compile time.
+struct DecodeTable
 {
-	for (int i = 0; i < 8; ++i)
+	uint16_t low[256];	// byte 2 -> bits 0-7
+	uint16_t high[4];	// top 2 bits of byte 3 -> bits 8-9
+
+	constexpr DecodeTable() : low(), high()
+	{
+		for (unsigned b = 0; b < 256; ++b)
+		{
+			for (unsigned bit = 0; bit < 8; ++bit)
+			{
+				if (b & (0x80 >> bit))
+					low[b] |= 1 << bit;
+			}
+		}
+		for (unsigned b = 0; b < 4; ++b)
+		{
+			high[b] = ((b & 0x02) ? 0x0100 : 0) | ((b & 0x01) ? 0x0200 : 0);
+		}
+	}
+};
+
+static constexpr DecodeTable decodeTable;
+
+ADC::ADC(unsigned _period) : GenericSensor(_period), spiDevId(SPI_DEV_0), period(_period), elapsed(0)
+{
+	for (unsigned i = 0; i < NumChannels; ++i)
+	{
 		digitalCodes[i] = 0;
+		sampleCounts[i] = 0;
+		voltages[i] = 0.0;
+		samplePeriods[i] = 0;
+		dueTimes[i] = 0;
+	}
+
+    // build the conversion commands once, they never change
+    memset(transfers, 0, sizeof(transfers));
+    memset(inbufs, 0, sizeof(inbufs));
+    for (unsigned i = 0; i < NumChannels; ++i)
+    {
+        // start bit, single ended, channel i
+        outbufs[i][0] = 0xc0 | (i << 3);
+        outbufs[i][1] = outbufs[i][2] = outbufs[i][3] = 0;
+
+        transfers[i].tx_buf = (unsigned long)outbufs[i];
+        transfers[i].rx_buf = (unsigned long)inbufs[i];
+        transfers[i].len = TransferLen;
+        transfers[i].delay_usecs = 0;
+    }
 
     // init the SPI device and cache the FD
 	if ((fd = InitSPI(spiDevId)) == -1)
@@ -22,40 +68,68 @@ ADC::ADC(unsigned _period) : GenericSensor(_period), spiDevId(SPI_DEV_0)
     }
 }
 
+void ADC::Subscribe(unsigned channel, unsigned samplePeriod)
+{
+	if (channel >= NumChannels || samplePeriod == 0)
+	{
+		throw DP::FrameworkException("ADC", ERR_PARAMS);
+	}
+	samplePeriods[channel] = samplePeriod;
+	dueTimes[channel] = elapsed;
+}
+
+void ADC::Unsubscribe(unsigned channel)
+{
+	if (channel >= NumChannels)
+	{
+		throw DP::FrameworkException("ADC", ERR_PARAMS);
+	}
+	samplePeriods[channel] = 0;
+}
+
+unsigned ADC::Decode(const uint8_t *inbuf)
+{
+    return decodeTable.high[inbuf[3] >> 6] | decodeTable.low[inbuf[2]];
+}
+
 void ADC::Routine()
 {
-    unsigned dcode;    // a single adc reading
-    uint8_t inbuf[4];  // data to receive
-    uint8_t outbuf[4]; // data to send
+    unsigned count = 0;
 
-    struct spi_ioc_transfer tr =
-    {
-        tr.tx_buf = (unsigned long)outbuf,
-        tr.rx_buf = (unsigned long)inbuf,
-        tr.len = 4,
-        tr.delay_usecs = 0,
-    };
+    elapsed += period;
 
-    for (int i = 0; i < 8; i++)
+    // gather the conversions of the channels that are due
+    for (unsigned i = 0; i < NumChannels; i++)
     {
-        // start bit, single ended, channel 0
-        outbuf[0] = 0xc0 | (i << 3);
-        outbuf[1] = outbuf[2] = outbuf[3] = 0;
-        if (ioctl(fd, SPI_IOC_MESSAGE(1), &tr) == -1)
+        if (samplePeriods[i] != 0 && elapsed >= dueTimes[i])
         {
-        	throw DP::FrameworkException("ADC", ERR_READ);
+            dueTimes[i] = elapsed + samplePeriods[i];
+            batch[count] = transfers[i];
+
+            // the MCP3008 needs CS deasserted between conversions
+            batch[count].cs_change = 1;
+            batchChannels[count++] = i;
         }
-        dcode  = ((uint16_t)(inbuf[3]) << 3) & 0x0200;
-        dcode += ((uint16_t)(inbuf[3]) << 1) & 0x0100;
-        dcode += ((uint16_t)(inbuf[2]) << 7) & 0x0080;
-        dcode += ((uint16_t)(inbuf[2]) << 5) & 0x0040;
-        dcode += ((uint16_t)(inbuf[2]) << 3) & 0x0020;
-        dcode += ((uint16_t)(inbuf[2]) << 1) & 0x0010;
-        dcode += ((uint16_t)(inbuf[2]) >> 1) & 0x0008;
-        dcode += ((uint16_t)(inbuf[2]) >> 3) & 0x0004;
-        dcode += ((uint16_t)(inbuf[2]) >> 5) & 0x0002;
-        dcode += ((uint16_t)(inbuf[2]) >> 7) & 0x0001;
-        digitalCodes[i] = dcode;
+    }
+    if (count == 0)
+    {
+        return;
+    }
+    batch[count - 1].cs_change = 0;
+
+    // convert them all in one syscall
+    if (SPITransfer(fd, batch, count) == -1)
+    {
+    	throw DP::FrameworkException("ADC", ERR_READ);
+    }
+
+    for (unsigned n = 0; n < count; n++)
+    {
+        unsigned channel = batchChannels[n];
+
+        digitalCodes[channel] = Decode(inbufs[channel]);
+        voltages[channel] = digitalCodes[channel] * VoltsPerCode;
+        ++sampleCounts[channel];
     }
 }
 
@@ -67,33 +141,6 @@ int ADC::InitSPI(const char *dev)
     static uint8_t mode = 0;
     static uint8_t bits = 8;
     static uint32_t speed = 1000000;
-    int fd;
 
-    fd = open(dev, O_RDWR);
-    if (fd < 0)
-        return(-1);
-
-    /* spi mode */
-    if ((ioctl(fd, SPI_IOC_WR_MODE, &mode) == -1) ||
-        (ioctl(fd, SPI_IOC_RD_MODE, &mode) == -1))
-    {
-        return(-1);
-    }
-
-    /* bits per word */
-    if ((ioctl(fd, SPI_IOC_WR_BITS_PER_WORD, &bits) == -1) ||
-        (ioctl(fd, SPI_IOC_RD_BITS_PER_WORD, &bits) == -1))
-    {
-        return(-1);
-    }
-
-    /* max speed hz */
-    if ((ioctl(fd, SPI_IOC_WR_MAX_SPEED_HZ, &speed) == -1) ||
-        (ioctl(fd, SPI_IOC_RD_MAX_SPEED_HZ, &speed) == -1))
-    {
-        return(-1);
-    }
-
-    return(fd);
+    return SPIOpen(dev, mode, bits, speed);
 }
-
@@ -0,0 +1,92 @@
+/*
+ *  battery.cpp
+ *
+ *  Description: Implementation of the battery state of charge estimator
+ */
+
+#include <cmath>
+#include <dp_dc2.h>
+#include "battery.h"
+
+constexpr unsigned BatteryEstimator::SamplePeriods[];
+
+// resting LiPo cell voltage by state of charge, in steps of 10%
+static const float CellCurve[] = {3.30, 3.69, 3.73, 3.77, 3.80, 3.84, 3.87, 3.95, 4.02, 4.11, 4.20};
+static const unsigned CellCurveLength = sizeof(CellCurve) / sizeof(CellCurve[0]);
+
+static const char* LevelNames[BatteryEstimator::NUM_LEVELS] = {"ok", "low", "critical", "cutoff"};
+
+BatteryEstimator::BatteryEstimator(const Pack& _pack) :
+	pack(_pack), lastTime_us(0), voltage(0.0), current(0.0), stateOfCharge(0.0), runtime(0.0), level(BATTERY_OK)
+{
+	cutoffCharge = ChargeOf(pack.cutoffVoltage / pack.cells);
+}
+
+float BatteryEstimator::ChargeOf(float cellVoltage)
+{
+	if (cellVoltage <= CellCurve[0])
+		return 0.0;
+
+	for (unsigned i = 1; i < CellCurveLength; ++i)
+	{
+		if (cellVoltage <= CellCurve[i])
+			return (i - 1 + (cellVoltage - CellCurve[i - 1]) / (CellCurve[i] - CellCurve[i - 1])) / (CellCurveLength - 1);
+	}
+
+	return 1.0;
+}
+
+float BatteryEstimator::Current(const char modes[2], const float powers[2]) const
+{
+	float load = pack.idleCurrent;
+
+	// a motor only draws while it is driven, BREAK and COAST draw nothing
+	for (int i = 0; i < 2; ++i)
+	{
+		if (modes[i] == DP::DC2::FORWARD || modes[i] == DP::DC2::REVERSE)
+			load += pack.motorCurrent * fabsf(powers[i]) / 100;
+	}
+	return load;
+}
+
+BatteryEstimator::LEVEL BatteryEstimator::Update(uint64_t time_us, float terminalVoltage, float loadCurrent)
+{
+	// what the pack would read with no load
+	float openVoltage = terminalVoltage + loadCurrent * pack.resistance;
+
+	// first order low pass filters that hold for any spacing of the samples
+	if (lastTime_us == 0)
+	{
+		voltage = openVoltage;
+		current = loadCurrent;
+	}
+	else
+	{
+		float dt = (time_us - lastTime_us) / 1e6;
+		voltage += (openVoltage - voltage) * dt / (VoltageTau + dt);
+		current += (loadCurrent - current) * dt / (CurrentTau + dt);
+	}
+	lastTime_us = time_us;
+
+	stateOfCharge = ChargeOf(voltage / pack.cells);
+	float charge_As = (stateOfCharge > cutoffCharge) ? (stateOfCharge - cutoffCharge) * pack.capacity_Ah * 3600 : 0.0;
+	runtime = charge_As / current;
+
+	// the level never goes back down, a passing rise in the voltage does not recharge the pack
+	LEVEL now = BATTERY_OK;
+	if (voltage < pack.cutoffVoltage)
+		now = BATTERY_CUTOFF;
+	else if (runtime < CriticalRuntime)
+		now = BATTERY_CRITICAL;
+	else if (runtime < LowRuntime)
+		now = BATTERY_LOW;
+	if (now > level)
+		level = now;
+
+	return level;
+}
+
+const char* BatteryEstimator::LevelName(LEVEL level)
+{
+	return LevelNames[level];
+}
@@ -0,0 +1,24 @@
+/*
+ *  clock.cpp
+ *
+ *  Description: Implementation of the monotonic time source
+ */
+
+#include <time.h>
+#include "clock.h"
+
+uint64_t MonotonicTime_us()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+uint64_t PacketArrival_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
@@ -10,7 +10,19 @@
 Controller::Controller(Context& ctx, bool _isVerbose) :
 	Callback(Period),
 	ui(ctx.ui), locomotive(ctx.locomotive), edgeDetector(ctx.edgeDetector), rangeSensor(ctx.rangeSensor),
-	isVerbose(_isVerbose), edge(EdgeDetector::LEFT), 	distanceToMove(0), angleToTurn(0.0)
+	sensors(ctx.sensors), isVerbose(_isVerbose), edge(EdgeDetector::LEFT)
 
 {
+	sensors.Read(&frame);
+	edgeDetector.SetEdgeHandler(this);
+}
+
+Controller::~Controller()
+{
+	edgeDetector.SetEdgeHandler(0);
+}
+
+void Controller::OnEdge(enum EdgeDetector::EDGE_SENSORS edge)
+{
+	Routine();
 }
@@ -0,0 +1,95 @@
+/*
+ *  flight_recorder.cpp
+ *
+ *  Description: Implementation of the flight recorder
+ */
+
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <dp_events.h>
+#include "clock.h"
+#include "flight_recorder.h"
+
+FlightRecorder flightRecorder;
+
+FlightRecorder::FlightRecorder() : header(0), records(0), mask(0), length(0)
+{
+}
+
+FlightRecorder::~FlightRecorder()
+{
+	Close();
+}
+
+void FlightRecorder::Open(const char* path, unsigned capacity)
+{
+	int fd;
+	void* map;
+
+	// the ring index is a mask, so the capacity must be a power of 2
+	if (IsOpen() || capacity == 0 || (capacity & (capacity - 1)) != 0)
+	{
+		throw DP::FrameworkException("FlightRecorder", ERR_PARAMS);
+	}
+
+	// size the file up front so that no record ever extends it
+	length = sizeof(FlightRecorderHeader) + (size_t)capacity * sizeof(FlightRecord);
+	if ((fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0)
+	{
+		throw DP::FrameworkException("FlightRecorder", ERR_INITIALIZATION);
+	}
+	if (ftruncate(fd, length) < 0)
+	{
+		close(fd);
+		throw DP::FrameworkException("FlightRecorder", ERR_INITIALIZATION);
+	}
+	map = mmap(0, length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+	{
+		throw DP::FrameworkException("FlightRecorder", ERR_INITIALIZATION);
+	}
+
+	// touch every page now rather than fault them in while recording
+	memset(map, 0, length);
+
+	header = (FlightRecorderHeader*)map;
+	memcpy(header->magic, "JEFEFDR", 8);
+	header->version = FlightRecorderHeader::Version;
+	header->recordSize = sizeof(FlightRecord);
+	header->capacity = capacity;
+	header->startTime_us = MonotonicTime_us();
+	header->head.store(0, std::memory_order_relaxed);
+
+	records = (FlightRecord*)(header + 1);
+	mask = capacity - 1;
+}
+
+void FlightRecorder::Close()
+{
+	if (!IsOpen())
+		return;
+
+	msync(header, length, MS_SYNC);
+	munmap(header, length);
+	header = 0;
+	records = 0;
+	mask = 0;
+	length = 0;
+}
+
+void FlightRecorder::Record(RECORD_TYPE type, unsigned source, int32_t v0, int32_t v1, int32_t v2)
+{
+	// claim a slot, then fill it; a reader after a crash may see at most the last one torn
+	uint64_t n = header->head.fetch_add(1, std::memory_order_relaxed);
+	FlightRecord& r = records[n & mask];
+
+	r.time_us = MonotonicTime_us();
+	r.type = type;
+	r.source = source;
+	r.values[0] = v0;
+	r.values[1] = v1;
+	r.values[2] = v2;
+}
@@ -3,225 +3,269 @@
  * 
  *  Description:  This is the "go to object" controller for jefebot.  In this mode, jefebot
  *  will find an object on the table, go to it, and push it off.  The algorithm is as follows:
- *      1. Spin one complete revolution CW to find the closest object within bounds and save the distance.
- *      2. Spin CW until the object is first detected again and save this "found" tick count.  
- *      3. Continue to spin CW until the object is lost and save that "lost" tick count. Calculate 
- *         the tick count to spin CCW to point to the theoretical middle of the object by spliting
- *         the difference of the "lost" and "found" tick counts.
- *      4. Spin CCW by the amount calculated in step 3 to point to the middle of the object.
- *      5. Move forward to the object all the time making sure the object doesn't get lost or 
+ *      1. Spin CW until the range sensors together have looked every way, a full revolution
+ *         for a single sensor, recording the range and heading of every range reading into a
+ *         profile of the surroundings.
+ *      2. From the profile, find the closest object within bounds and its angular extent,
+ *         i.e. the run of readings around the closest one that are within ObjectDepth of it,
+ *         and take the middle of that run as the heading of the middle of the object.
+ *      3. Spin straight to that heading, whichever way is shorter, then move forward.
+ *      4. Move forward to the object all the time making sure the object doesn't get lost or 
  *         encounter an edge, due to the bot's drifting off course.  If the object is lost,
- *         go back to step 2; if an edge is detected, just stop.
- *      6. Continue to move forward to push the object off the table, making sure no edges are
+ *         go back to step 1; if an edge is detected, just stop.
+ *      5. Continue to move forward to push the object off the table, making sure no edges are
  *         encountered.  If the front edge is detected, the object is presumably pushed off the
  *         table, but if any other edges are encountered, just stop.
- *      7. Immediately move back a few cenimeters to prevent the bot from itself falling off.
+ *      6. Immediately move back a few cenimeters to prevent the bot from itself falling off.
  *
- *  The controller is implemented as a state machine with the first 7 states corresponding
- *  to the steps of the algorithm described above.  There are 2 extra states, one that is 
- *  entered when an edge is encountered, and a final, completion state.
+ *  The controller is implemented as a state machine with the first 6 states corresponding
+ *  to the steps of the algorithm described above, where steps 1 and 2 share a state.  There
+ *  are 2 extra states, one that is entered when an edge is encountered, and a final,
+ *  completion state.  The states, their actions and their transitions are declared in the
+ *  table in goto_object_controller.h.
  *
  *  The Routine() function is registered in the main program as a periodic event handler, and
  *  is therefore continually called at a rate specified during its registration.
 */
 
 #include "stdlib.h"
+#include <cmath>
+#include <algorithm>
 #include "goto_object_controller.h"
+#include "latency.h"
+#include "profiler.h"
+#include "sound.h"
 
-//#define TRIM 0
-#define TRIM 1
-//#define TRIM 2
-//#define TRIM 3
+constexpr GotoObjectController::Row GotoObjectController::States[];
 
 GotoObjectController::GotoObjectController(Context& ctx, bool isVerbose) :
-		Controller(ctx, isVerbose), state(ESTABLISH_RANGE), objDistance(-1)
+		Controller(ctx, isVerbose), objDistance(-1), numScanSamples(0), lastOdometryTime_us(0), lastHeading(0.0), machine(*this, ControllerTracer(FR_GOTO_OBJECT, isVerbose))
 {
-	if (isVerbose) printf("changing state to ESTABLISH_RANGE...\n");
-	angleToTurn = 2*PI;
-	locomotive.SpinCW();
+	for (unsigned i = 0; i < MultiPingRangeSensor::MaxSensors; ++i)
+		lastRangeTimes_us[i] = 0;
 	ui.Display(0x02);
+	machine.Start(ESTABLISH_RANGE);
 }
 
-void GotoObjectController::Routine()
+void GotoObjectController::StartScan()
 {
-	unsigned distance;
-	static int tickCount = 0, targetCount = 0;
+	// spin until every heading has passed a sensor, Scan() records the range profile as it goes
+	Locomotive::MotionSegment revolution = {Locomotive::MOTION_SPIN_CW, rangeSensor.GetScanAngle()};
+
+	numScanSamples = 0;
+	locomotive.Submit(&revolution, 1, this);
+}
+
+bool GotoObjectController::LocateObject(float* pHeading)
+{
+	unsigned closest = numScanSamples;
+	unsigned first, last;
+
+	// the sensors' readings interleave, so put the profile in heading order
+	std::sort(scan, scan + numScanSamples, [](const ScanSample& a, const ScanSample& b) {
+		return a.heading < b.heading;
+	});
 
-	switch (state)
+	// find the closest reading within bounds
+	objDistance = -1;
+	for (unsigned i = 0; i < numScanSamples; ++i)
 	{
-		case ESTABLISH_RANGE:
-			// start the process by spinning 2pi radians CW to find the range of the closest object
-			if (!locomotive.HasTurnedAngle(angleToTurn))
-			{
-				if (rangeSensor.DetectObject(0, &distance))
-				{
-				    // keep updating the range of the closest object within bounds as the bot spins
-					if (distance < objDistance)
-					{
-						objDistance = distance;
-					}
-				}
-			}
-			else
-			{
-			    // once the range has been established go on to find the object
-				if (isVerbose)
-				{
-					printf("object found at distance %d\n", objDistance);
-					printf("changing state to FIND_OBJECT...\n");
-				}
-
-				// adjust the range a little farther, clear the heading (ticks) then go on to find the object
-				objDistance += 10;
-				locomotive.Stop();
-				locomotive.ClearTicks();
-				locomotive.SpinCW();
-				state = FIND_OBJECT;
-			}
-			break;
+		if (scan[i].distance < objDistance && rangeSensor.IsWithinBounds(scan[i].distance))
+		{
+			objDistance = scan[i].distance;
+			closest = i;
+		}
+	}
+	if (closest == numScanSamples)
+	{
+		return false;
+	}
 
-		case FIND_OBJECT:
-		    // spin CW until the object is first detected in the established range
-			if (rangeSensor.DetectObject(objDistance, &distance))
-			{
-				// get the tick count when the object is first detected
-				tickCount = locomotive.GetTicks(Locomotive::LEFT);
-				targetCount = tickCount;
-				state = MEASURE_OBJECT;
-				if (isVerbose)
-				{
-					printf("object found at distance %d\n", distance);
-					printf("TickCount = %d\n", tickCount);
-					printf("changing state to MEASURE_OBJECT...\n");
-				}
-			}
+	// the object extends either way from there for as long as the readings stay near it,
+	// the profile is a full circle so the run may wrap around its ends
+	objDistance += ObjectDepth;
+	first = last = closest;
+	for (unsigned n = 1; n < numScanSamples; ++n)
+	{
+		unsigned i = (closest + numScanSamples - n) % numScanSamples;
+		if (scan[i].distance >= objDistance)
 			break;
-
-		case MEASURE_OBJECT:
-			// continue spinning until the object is undetected
-			if (!rangeSensor.DetectObject(objDistance, &distance))
-			{
-				int tickDelta;
-
-				locomotive.Stop();
-				
-				// get the tick count of when the object is first undetected
-				tickCount = locomotive.GetTicks(Locomotive::LEFT);
-				if (isVerbose)
-				{
-					printf("TickCount = %d\n", tickCount);
-				}
-				
-				// calculate the amount to spin CCW to point to the middle of the object
-				tickDelta = ((tickCount - targetCount) / 2);
-				targetCount += tickDelta - TRIM;
-				if (isVerbose)
-				{
-					printf("TargetCount = %d\n", targetCount);
-				}
-				// TODO: change to a specific amount of angle to spin to eliminate the adjust position state
-				//       -- this will require much more accurate odometry
-				locomotive.SpinCCW();
-				state = ADJUST_POSITION;
-				if (isVerbose)
-				{
-					printf("changing state to ADJUST_POSITION...\n");
-				}
-			}
+		first = i;
+	}
+	for (unsigned n = 1; n < numScanSamples; ++n)
+	{
+		unsigned i = (closest + n) % numScanSamples;
+		if (scan[i].distance >= objDistance || i == first)
 			break;
+		last = i;
+	}
 
-		case ADJUST_POSITION:
-			// spin CCW by the amount calculated to point to the theoretical middle of the object
-			tickCount = locomotive.GetTicks(Locomotive::LEFT);
-			if (tickCount <= targetCount)
-			{
-				// the middle of the object has been found so move forward to it
-				locomotive.Stop();
-				if (isVerbose)
-				{
-					printf("TickCount = %d\n", tickCount);
-				}
-				locomotive.MoveForward();
-				if (isVerbose) printf("changing state to GOTO_OBJECT...\n");
-				state = GOTO_OBJECT;
-			}
-			break;
+	// the middle of the run; its width is the sum of the steps between its samples in
+	// scan order, each forward, as the end to end difference wraps once it is over pi
+	float extent = 0.0;
+	for (unsigned i = first; i != last; i = (i + 1) % numScanSamples)
+	{
+		float step = scan[(i + 1) % numScanSamples].heading - scan[i].heading;
+		extent += (step < 0.0) ? step + 2*M_PI : step;
+	}
+	*pHeading = remainderf(scan[first].heading + extent / 2, 2*M_PI);
 
-		case GOTO_OBJECT:
-			if (rangeSensor.AtObject())
-			{
-			    // when the bot is at the object go on to push it
-				state = PUSH_OBJECT;
-				if (isVerbose)
-				{
-					printf("object reached at distance %d\n", rangeSensor.GetDistance());
-					printf("changing state to PUSH_OBJECT...\n");
-				}
-			}
-			else if (!rangeSensor.DetectObject(objDistance, &distance))
-			{
-			    // the object was lost so try to find it again
-				locomotive.SpinCW();
-				state = FIND_OBJECT;
-				if (isVerbose)
-				{
-					printf("object lost at distance %d\n", distance);
-					printf("changing state to FIND_OBJECT...\n");
-				}
-			}
-			else if (edgeDetector.AtAnyEdge())
-			{
-			    // need to avoid any edge at this point
-		        if (isVerbose) printf("changing state to AVOID_EDGE...\n");
-		        state = AVOID_EDGE;
-			}
-			break;
+	if (isVerbose)
+	{
+		logger.Print("object found at distance %d, extent %.2f radians\n", objDistance - ObjectDepth, extent);
+	}
+	return true;
+}
 
-		case PUSH_OBJECT:
-			if (edgeDetector.AtAnyEdge(&edge))
-			{
-				switch (edge)
-				{
-					case EdgeDetector::FRONT:
-					    // when the front edge is detected, the object has been pushed off the table, so stop the bot and immediately back up to prevent from falling off with the object
-						locomotive.Stop();
-				        distanceToMove = 6;
-				        locomotive.MoveReverse();
-				        if (isVerbose) printf("changing state to PREVENT_FALLING...\n");
-				        state = PREVENT_FALLING;
-						break;
-					default:
-					    // any other edge is a problem so need to avoid it
-				        if (isVerbose) printf("changing state to AVOID_EDGE...\n");
-				        state = AVOID_EDGE;
-						break;
-				}
-			}
+void GotoObjectController::OnMotionComplete()
+{
+	switch (machine.Current())
+	{
+		case ESTABLISH_RANGE:
+			// the scan is complete so turn to the object
+			machine.ChangeState(TURN_TO_OBJECT);
 			break;
 
-		case AVOID_EDGE:
-			// simply stop to avoid the edge then shutdown			    
-			locomotive.Stop();
-		    system("/home/jefebot/controller/sounds/play_wawa.bat");
-			Shutdown("...edge detected\n", 0);
+		case TURN_TO_OBJECT:
+			// pointing at the object and moving forward
+			machine.ChangeState(GOTO_OBJECT);
 			break;
 
-		case PREVENT_FALLING:
-			if (locomotive.HasMovedDistance(distanceToMove))
-			{
-			    // the bot has moved back to avoid falling off with the object so complete the objective
-				locomotive.Stop();
-				state = COMPLETE;
-			}
+		default:
 			break;
+	}
+}
 
-		case COMPLETE:
-		    system("/home/jefebot/controller/sounds/play_woohoo.bat");
-			Shutdown("...objective achieved\n", 0);
-			break;
+void GotoObjectController::Routine()
+{
+	PROFILE_CALLBACK("GotoObjectController", Period);
 
-		default:
-			assert(false);
+	ReadSensors();
+	machine.Tick();
+}
+
+void GotoObjectController::Scan()
+{
+	// record each new range reading with the heading it was taken at as the bot spins,
+	// i.e. the bot's heading plus the sensor's mount angle; the range and the pose arrive
+	// at different times, so the heading is extrapolated to the range reading's time at
+	// the current rate of turn
+	for (unsigned i = 0; i < rangeSensor.GetNumSensors(); ++i)
+	{
+		if (frame.rangeTimes_us[i] == lastRangeTimes_us[i] || numScanSamples == MaxScanSamples)
+			continue;
+
+		float heading = frame.pose.heading + rangeSensor.GetMount(i).angle;
+		if (lastOdometryTime_us != 0 && frame.odometryTime_us > lastOdometryTime_us)
+		{
+			float rate = remainderf(frame.pose.heading - lastHeading, 2*M_PI) /
+				(frame.odometryTime_us - lastOdometryTime_us);
+			heading += rate * ((int64_t)frame.rangeTimes_us[i] - (int64_t)frame.odometryTime_us);
+		}
+		lastRangeTimes_us[i] = frame.rangeTimes_us[i];
+		scan[numScanSamples].heading = remainderf(heading, 2*M_PI);
+		scan[numScanSamples].distance = frame.ranges[i];
+		++numScanSamples;
+	}
+	if (frame.odometryTime_us != lastOdometryTime_us)
+	{
+		lastOdometryTime_us = frame.odometryTime_us;
+		lastHeading = frame.pose.heading;
+	}
+}
+
+void GotoObjectController::TurnToObject()
+{
+	// turn to the middle of the object and go to it
+	float heading;
+	Pose pose;
+	if (!LocateObject(&heading))
+	{
+		Shutdown("...no object found\n", 0);
+		return;
+	}
+
+	locomotive.GetPose(&pose);
+	float turn = remainderf(heading - pose.heading, 2*M_PI);
+	Locomotive::MotionSegment segments[2] =
+	{
+		{(turn < 0.0) ? Locomotive::MOTION_SPIN_CW : Locomotive::MOTION_SPIN_CCW, fabsf(turn)},
+		{Locomotive::MOTION_FORWARD, 0.0}
+	};
+	locomotive.Submit(segments, 2, this);
+}
+
+void GotoObjectController::GotoObject()
+{
+	unsigned distance;
+
+	if (rangeSensor.AtObject(frame))
+	{
+		// when the bot is at the object go on to push it
+		if (isVerbose) logger.Print("object reached at distance %d\n", frame.distance);
+		machine.ChangeState(PUSH_OBJECT);
+	}
+	else if (!rangeSensor.DetectObject(frame, objDistance, &distance))
+	{
+		// the object was lost so scan for it again
+		locomotive.Stop();
+		if (isVerbose) logger.Print("object lost at distance %d\n", distance);
+		machine.ChangeState(ESTABLISH_RANGE);
+	}
+	else if (edgeDetector.AtAnyEdge(frame))
+	{
+		// need to avoid any edge at this point
+		edgeLatency.EdgeDecided();
+		machine.ChangeState(AVOID_EDGE);
+	}
+}
+
+void GotoObjectController::PushObject()
+{
+	if (edgeDetector.AtAnyEdge(frame, &edge))
+	{
+		edgeLatency.EdgeDecided();
+		switch (edge)
+		{
+			case EdgeDetector::FRONT:
+				// when the front edge is detected, the object has been pushed off the table
+				machine.ChangeState(PREVENT_FALLING);
+				break;
+			default:
+				// any other edge is a problem so need to avoid it
+				machine.ChangeState(AVOID_EDGE);
+				break;
+		}
 	}
 }
 
+void GotoObjectController::AvoidEdge()
+{
+	// simply stop to avoid the edge then shutdown
+	locomotive.Stop();
+	soundPlayer.Play(SoundPlayer::SOUND_WAWA);
+	Shutdown("...edge detected\n", 0);
+}
+
+void GotoObjectController::BackUp()
+{
+	// stop the bot and immediately back up to prevent from falling off with the object
+	locomotive.Stop();
+	locomotive.MoveReverse();
+}
+
+void GotoObjectController::PreventFalling()
+{
+	if (locomotive.HasMovedDistance(BackUpDistance))
+	{
+		// the bot has moved back to avoid falling off with the object so complete the objective
+		machine.ChangeState(COMPLETE);
+	}
+}
+
+void GotoObjectController::Complete()
+{
+	locomotive.Stop();
+	soundPlayer.Play(SoundPlayer::SOUND_WOOHOO);
+	Shutdown("...objective achieved\n", 0);
+}
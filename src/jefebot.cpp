@@ -14,7 +14,7 @@
  *   control programs are events.
  * 
  * Synopsis:
- *     jefebot [-m<mode> -e <edge thresh> -o <obj outer> -i <obj inner> -s <speed> -p<v|s> -d <distance> -a <angle> -v -h]
+ *     jefebot [-m<mode> -e <edge thresh> -o <obj outer> -i <obj inner> -s <speed> -p<v|s> -d <distance> -a <angle> -n <sensors> -r <file> -l <socket> -R -T -t -v -h]
  *
  *     options:
  *         -m <mode>:     set the controller mode: 'r' = Roam, 'o' = GoToObject
@@ -25,22 +25,48 @@
  *         -p <value>:    print sensor values: 'v' = battery voltage, 's' = all distance sensors (range and edge)
  *         -d <value>:    move forward the specified number of centimeters
  *         -a <value>:    spin CW the specified number of radians
+ *         -n <value>:    set how many range sensors are fitted, 1-4, see RangeMounts
+ *         -r <file>:     record sensors, motor commands and state transitions to a flight recorder file
+ *         -l <socket>:   publish them live on a Unix datagram socket, see telemetry.h and
+ *                        tools/telemetry_sub
+ *         -R, --realtime: lock memory, pin to a CPU and run under SCHED_FIFO, and report the
+ *                        jitter of the control period at shutdown; see realtime.h
+ *         -T, --threaded: run the controller and the locomotive's PIDs on a control thread and
+ *                        log from a low priority thread, see pipeline.h and logger.h
+ *         -t:            profile the event handlers and print their timing at shutdown
  *         -v:            set verbose mode
  *         -h:            display this help
+ *
+ *     signals:
+ *         SIGUSR1:       print the edge to stop latency histograms
+ */
 
 #include <cstdio>
 #include <cstdlib>
+#include <cmath>
 #include <cassert>
 #include <unistd.h>
 #include <getopt.h>
+#include <csignal>
+#include <thread>
 #include "roam_controller.h"
 #include "goto_object_controller.h"
+#include "latency.h"
+#include "profiler.h"
+#include "flight_recorder.h"
+#include "telemetry.h"
+#include "sound.h"
+#include "realtime.h"
+#include "pipeline.h"
+#include "logger.h"
+#include "clock.h"
 
 // control program errors
 #define ERR_CONTROLLER_MODE		-2001
 #define ERR_LOW_VOLTAGE			-2002
 
 // readable timeout values
+#define PERIOD_10_mSEC 10
 #define PERIOD_50_mSEC 50
 #define PERIOD_100_mSEC 100
 #define PERIOD_300_mSEC 300
@@ -50,18 +76,44 @@
 
 // battery constants
 #define ADC_BATT_CHANNEL 7
+#define ADC_BATT_DIVIDER 4
 #define BATTERY_CUTOFF_VOLTAGE 10.0
-#define BatteryVoltage (4 * voltMeter->GetVoltage(ADC_BATT_CHANNEL))
+#define BatteryVoltage (voltMeter->GetBatteryVoltage())
+
+// the 3 cell 1 Ah LiPo pack, and the current drawn by the electronics and by a motor at full power
+static const BatteryEstimator::Pack BatteryPack = {3, 1.0, 0.3, 0.25, 1.5, BATTERY_CUTOFF_VOLTAGE};
 
 // command line defaults
 #define DEFAULT_SPEED 35.0
 #ifdef USE_DISTANCE_NOT_VOLTAGE
-#define DEFAULT_EDGE_LIMIT ???
+#define DEFAULT_EDGE_LIMIT 30
 #else
 #define DEFAULT_EDGE_LIMIT 1000
 #endif
 #define DEFAULT_INNER_LIMIT 40
 #define DEFAULT_OUTER_LIMIT 1000
+#define DEFAULT_RANGE_SENSORS 1
+
+// where the range sensors are mounted, in the order they are fitted: the nose, the front
+// corners and the tail
+static const MultiPingRangeSensor::Mount RangeMounts[MultiPingRangeSensor::MaxSensors] =
+{
+	{DP::PING4::SENSOR_0, 0.0},
+	{DP::PING4::SENSOR_1, 0.8},
+	{DP::PING4::SENSOR_2, -0.8},
+	{DP::PING4::SENSOR_3, M_PI}
+};
+
+// how long a shutdown waits for the encoders to confirm the motors have stopped
+#define STOP_CONFIRM_TIMEOUT_mSEC 500
+
+// the sounds, wawa.wav and woohoo.wav, and what plays them; the simulated backend has no speaker
+#define SOUND_DIR "/home/jefebot/controller/sounds"
+#ifdef SIM_BACKEND
+static NullSoundSink soundSink;
+#else
+static PipeSoundSink soundSink("aplay -q");
+#endif
 
 // controller modes, i.e. behaviors
 enum CONTROLLER_MODE {CM_ROAM, CM_GOTO_OBJECT, CM_GOTO_GOAL};
@@ -79,7 +131,12 @@ struct Options
 	int nominalEdgeLimit;
 	int objectInnerLimit;
 	int objectOuterLimit;
+	unsigned numRangeSensors;
+	bool isRealtime;
+	bool isThreaded;
 	CONTROLLER_MODE controllerMode;
+	const char* flightRecordPath;
+	const char* telemetryPath;
 
 	Options() :
 		isVerbose(false),
@@ -92,17 +149,46 @@ struct Options
 		nominalEdgeLimit(DEFAULT_EDGE_LIMIT),
 		objectInnerLimit(DEFAULT_INNER_LIMIT),
 		objectOuterLimit(DEFAULT_OUTER_LIMIT),
-		controllerMode(CM_ROAM)
+		numRangeSensors(DEFAULT_RANGE_SENSORS),
+		isRealtime(false),
+		isThreaded(false),
+		controllerMode(CM_ROAM),
+		flightRecordPath(0),
+		telemetryPath(0)
 	{}
 } options;
 
 // jefebot elements
+SensorFrameBuffer sensors;
 UserInterface* ui;
 EdgeDetector* edgeDetector;
-SinglePingRangeSensor* rangeSensor;
+MultiPingRangeSensor* rangeSensor;
 Locomotive* locomotive;
 Controller* controller;
-ADC* voltMeter;
+VoltMeter* voltMeter;
+ControlPipeline* pipeline;
+
+// a shutdown waiting for the stop to be confirmed, see Shutdown(); it may be requested from
+// the control thread and is confirmed from the event loop's
+struct ShutdownRequest
+{
+	std::atomic<bool> isClaimed;	// by the first request
+	std::atomic<bool> isPending;	// once the rest is filled in
+	const char* msg;
+	int error;
+	uint64_t request_ns;	// Profiler::Now_ns() of the request
+	uint64_t request_us;	// MonotonicTime_us() of the request
+} shutdownRequest;
+
+static void FinishShutdown();
+
+// set by SIGUSR1 to request a dump of the latency histograms
+volatile sig_atomic_t isLatencyDumpRequested = 0;
+
+static void RequestLatencyDump(int sig)
+{
+	isLatencyDumpRequested = 1;
+}
 
 // convert error code to error description string
 const char* GetErrorMsg(int err)
@@ -126,24 +212,40 @@ const char* GetErrorMsg(int err)
 
 // ***** periodic event handler routines *****
 
-// voltage watchdog routine to run every 10 Sec
+// battery watchdog routine; the estimator samples the battery as often as its level needs,
+// this only acts on the level: a warning when it is low, a shutdown, which stops the
+// motors first, when it is critical, i.e. well before the cells reach the cutoff
 BEGIN_PERIODIC_ROUTINE(VoltageWatchdog)
 
-	// check the battery voltage and shutdown if less than the cutoff value
-	if (BatteryVoltage < BATTERY_CUTOFF_VOLTAGE)
+	PROFILE_CALLBACK("VoltageWatchdog", PERIOD_100_mSEC);
+
+	static BatteryEstimator::LEVEL reported = BatteryEstimator::BATTERY_OK;
+	const BatteryEstimator& battery = voltMeter->GetBattery();
+
+	if (battery.GetLevel() != reported)
 	{
-		Shutdown("jefebot", ERR_LOW_VOLTAGE);
+		reported = battery.GetLevel();
+		logger.Print("jefebot: battery %s, %.1f V, %.0f%% charge, about %.0f S left\n",
+			BatteryEstimator::LevelName(reported), battery.GetVoltage(), battery.GetStateOfCharge() * 100,
+			battery.GetRuntime());
+		if (reported >= BatteryEstimator::BATTERY_CRITICAL)
+		{
+			Shutdown("jefebot", ERR_LOW_VOLTAGE);
+		}
 	}
 
-END_PERIODIC_ROUTINE(VoltageWatchdog)(PERIOD_10_SEC);
+END_PERIODIC_ROUTINE(VoltageWatchdog)(PERIOD_100_mSEC);
 
 // display the battery voltage
 BEGIN_PERIODIC_ROUTINE(DisplayBatteryVoltage)
 
+	PROFILE_CALLBACK("DisplayBatteryVoltage", PERIOD_100_mSEC);
+
 	if (BatteryVoltage == 0.0)
 	{
 		printf("jefebot: battery voltage reads 0 -- is it connected?\n");
 		Shutdown("jefebot", ERR_LOW_VOLTAGE);
+		return;
 	}
 	printf("battery voltage = %#.1f V\n", BatteryVoltage);
 	Shutdown();
@@ -153,6 +255,8 @@ END_PERIODIC_ROUTINE(DisplayBatteryVoltage)(PERIOD_100_mSEC);
 // periodic routine to show sensor values
 BEGIN_PERIODIC_ROUTINE(DisplaySensorValues)
 
+	PROFILE_CALLBACK("DisplaySensorValues", PERIOD_100_mSEC);
+
 	try
 	{
 		printf("range value=%u  edge sensors: 1=%u 2=%u 3=%u\n",
@@ -171,6 +275,8 @@ END_PERIODIC_ROUTINE(DisplaySensorValues)(PERIOD_100_mSEC);
 // periodic routine to test metered linear movement
 BEGIN_PERIODIC_ROUTINE(MoveDistance)
 
+	PROFILE_CALLBACK("MoveDistance", PERIOD_100_mSEC);
+
 	try
 	{
 		locomotive->MoveForward();
@@ -188,6 +294,8 @@ END_PERIODIC_ROUTINE(MoveDistance)(PERIOD_100_mSEC);
 // periodic routine to test angular movement
 BEGIN_PERIODIC_ROUTINE(SpinAngle)
 
+	PROFILE_CALLBACK("SpinAngle", PERIOD_100_mSEC);
+
 	try
 	{
 		locomotive->SpinCCW();
@@ -202,9 +310,26 @@ BEGIN_PERIODIC_ROUTINE(SpinAngle)
 
 END_PERIODIC_ROUTINE(SpinAngle)(PERIOD_100_mSEC);
 
+// periodic routine to complete a shutdown once the encoders confirm the motors have stopped
+BEGIN_PERIODIC_ROUTINE(ShutdownMonitor)
+
+	PROFILE_CALLBACK("ShutdownMonitor", PERIOD_10_mSEC);
+
+	if (shutdownRequest.isPending && (
+		locomotive->IsStopConfirmed() ||
+		MonotonicTime_us() - shutdownRequest.request_us >= STOP_CONFIRM_TIMEOUT_mSEC * 1000
+	))
+	{
+		FinishShutdown();
+	}
+
+END_PERIODIC_ROUTINE(ShutdownMonitor)(PERIOD_10_mSEC);
+
 // periodic routine to test for the pressing of button S3 to shutdown
 BEGIN_PERIODIC_ROUTINE(CheckInput)
 
+	PROFILE_CALLBACK("CheckInput", PERIOD_100_mSEC);
+
 	try
 	{
 		if (ui->IsButtonPressed(UserInterface::BUTTON3))
@@ -212,6 +337,13 @@ BEGIN_PERIODIC_ROUTINE(CheckInput)
 			Shutdown();
 		}
 
+		// dump the latency histograms on demand
+		if (isLatencyDumpRequested)
+		{
+			isLatencyDumpRequested = 0;
+			edgeLatency.Print(stdout);
+		}
+
 	} catch (DP::FrameworkException& e) {
 		Shutdown(e.what(), e.Error());
 	}
@@ -221,6 +353,8 @@ END_PERIODIC_ROUTINE(CheckInput)(PERIOD_100_mSEC);
 // periodic routine to animate LEDs to indicate test mode
 BEGIN_PERIODIC_ROUTINE(TestModeIndication)
 
+	PROFILE_CALLBACK("TestModeIndication", PERIOD_300_mSEC);
+
 	try
 	{
 		static unsigned char pattern = 0x55;
@@ -233,15 +367,41 @@ BEGIN_PERIODIC_ROUTINE(TestModeIndication)
 
 END_PERIODIC_ROUTINE(TestModeIndication)(PERIOD_300_mSEC);
 
+// periodic routine at the control period to send the telemetry to its subscribers
+BEGIN_PERIODIC_ROUTINE(PublishTelemetry)
+
+	PROFILE_CALLBACK("PublishTelemetry", PERIOD_50_mSEC);
+
+	telemetry.Publish(sensors);
+
+END_PERIODIC_ROUTINE(PublishTelemetry)(PERIOD_50_mSEC);
+
+// periodic routine at the control period to measure the period the event loop achieves
+static JitterProbe controlJitter(PERIOD_50_mSEC);
+
+BEGIN_PERIODIC_ROUTINE(ControlJitter)
+
+	PROFILE_CALLBACK("ControlJitter", PERIOD_50_mSEC);
+
+	controlJitter.Tick(MonotonicTime_us());
+
+END_PERIODIC_ROUTINE(ControlJitter)(PERIOD_50_mSEC);
+
 // ***** initialization and termination *****
 
 // parse the command line arguments
 static void ParseOptions(int argc, char* argv[])
 {
-	const char* optStr = "m:e:o:i:s:p:d:a:vh";
+	const char* optStr = "m:e:o:i:s:p:d:a:n:r:l:RTtvh";
+	const struct option longOpts[] =
+	{
+		{"realtime", no_argument, 0, 'R'},
+		{"threaded", no_argument, 0, 'T'},
+		{0, 0, 0, 0}
+	};
 	int opt;
 
-	while ((opt = getopt(argc, argv, optStr)) != -1)
+	while ((opt = getopt_long(argc, argv, optStr, longOpts, 0)) != -1)
 	{
 		switch (opt)
 		{
@@ -257,7 +417,7 @@ static void ParseOptions(int argc, char* argv[])
 					case 'r':
 						break;
 					default:
-						printf("usage: jefebot [-m<mode> -e <edge thresh> -o <obj outer> -i <obj inner> -s <speed> -p<v|s> -d <distance> -a <angle> -v -h]\n");
+						printf("usage: jefebot [-m<mode> -e <edge thresh> -o <obj outer> -i <obj inner> -s <speed> -p<v|s> -d <distance> -a <angle> -n <sensors> -r <file> -l <socket> -R -T -t -v -h]\n");
 						exit(ERR_CONTROLLER_MODE);
 				}
 				break;
@@ -284,7 +444,7 @@ static void ParseOptions(int argc, char* argv[])
 						options.doPrintSensorValues = true;
 						break;
 					default:
-						printf("usage: jefebot [-m<mode> -e <edge thresh> -o <obj outer> -i <obj inner> -s <speed> -p<v|s> -d <distance> -a <angle> -v -h]\n");
+						printf("usage: jefebot [-m<mode> -e <edge thresh> -o <obj outer> -i <obj inner> -s <speed> -p<v|s> -d <distance> -a <angle> -n <sensors> -r <file> -l <socket> -R -T -t -v -h]\n");
 						exit(ERR_INITIALIZATION);
 				}
 				break;
@@ -296,11 +456,29 @@ static void ParseOptions(int argc, char* argv[])
 				options.isTestMode = true;
 				options.angleToSpin = atof(optarg);
 				break;
+			case 'n':
+				options.numRangeSensors = atoi(optarg);
+				break;
+			case 'r':
+				options.flightRecordPath = optarg;
+				break;
+			case 'l':
+				options.telemetryPath = optarg;
+				break;
+			case 'R':
+				options.isRealtime = true;
+				break;
+			case 'T':
+				options.isThreaded = true;
+				break;
+			case 't':
+				profiler.Enable();
+				break;
 			case 'v':
 				options.isVerbose = true;
 				break;
 			case 'h':
-				printf("usage: jefebot [-m<mode> -e <edge thresh> -o <obj outer> -i <obj inner> -s <speed> -p<v|s> -d <distance> -a <angle> -v -h]\n");
+				printf("usage: jefebot [-m<mode> -e <edge thresh> -o <obj outer> -i <obj inner> -s <speed> -p<v|s> -d <distance> -a <angle> -n <sensors> -r <file> -l <socket> -R -T -t -v -h]\n");
 				printf("\n");
 				printf("     options:\n");
 				printf("         -m <mode>:     set the controller mode: 'r' = Roam, 'o' = GoToObject\n");
@@ -311,11 +489,17 @@ static void ParseOptions(int argc, char* argv[])
 				printf("         -p <value>:    print sensor values: 'v' = battery voltage, 's' = all distance sensors (range and edge)\n");
 				printf("         -d <value>:    move forward the specified number of centimeters\n");
 				printf("         -a <value>:    spin CW the specified number of radians\n");
+				printf("         -n <value>:    set how many range sensors are fitted, 1-4\n");
+				printf("         -r <file>:     record sensors, motor commands and state transitions to a flight recorder file\n");
+				printf("         -l <socket>:   publish them live on a Unix datagram socket, for telemetry_sub\n");
+				printf("         -R, --realtime: lock memory, pin to a CPU and run under SCHED_FIFO, and report the jitter\n");
+				printf("         -T, --threaded: run the controller and PIDs on a control thread, log from another\n");
+				printf("         -t:            profile the event handlers and print their timing at shutdown\n");
 				printf("         -v:            set verbose mode\n");
 				printf("         -h:            display this help\n");
 				exit(ERR_NONE);
 			default:
-				printf("usage: jefebot [-m<mode> -e <edge thresh> -o <obj outer> -i <obj inner> -s <speed> -p<v|s> -d <distance> -a <angle> -v -h]\n");
+				printf("usage: jefebot [-m<mode> -e <edge thresh> -o <obj outer> -i <obj inner> -s <speed> -p<v|s> -d <distance> -a <angle> -n <sensors> -r <file> -l <socket> -R -T -t -v -h]\n");
 				exit(ERR_INITIALIZATION);
 		}
 	}
@@ -335,16 +519,64 @@ void InitControlProgram(int argc, char* argv[], DP::EventContext& evtCtx)
 	{
 		// parse the command line options
 		ParseOptions(argc, argv);
+#ifdef SIM_BACKEND
+		// the control thread needs the real time clock, a replay runs on the recording's
+		if (options.isThreaded && evtCtx.GetReplay())
+		{
+			printf("jefebot: -T cannot be used with JEFEBOT_SIM_REPLAY, a replay runs on virtual time\n");
+			exit(ERR_INITIALIZATION);
+		}
+#endif
+
+		// a write to a pipe whose reader has gone, e.g. stdout piped into a pager that was
+		// quit, fails with EPIPE rather than kill jefebot with the motors running
+		signal(SIGPIPE, SIG_IGN);
+
+		// start the flight recorder first so that it sees the motors being initialized
+		if (options.flightRecordPath)
+		{
+			flightRecorder.Open(options.flightRecordPath);
+		}
+		if (options.telemetryPath)
+		{
+			telemetry.Open(options.telemetryPath);
+			evtCtx.Register(&PublishTelemetry);
+		}
+
+		// preload the sounds and play them from their own thread, never from the event loop
+		unsigned numSounds = soundPlayer.Load(SOUND_DIR);
+		if (options.isVerbose) printf("%u of %d sounds loaded from %s\n", numSounds, SoundPlayer::NUM_SOUNDS, SOUND_DIR);
+		soundPlayer.Start(&soundSink);
+
+		// log from a thread of its own
+		if (options.isThreaded)
+		{
+			logger.Start();
+		}
 
 		// create the elements of jefebot that are required for all modes
 		ui = new UserInterface(evtCtx);
-		edgeDetector = new EdgeDetector(evtCtx, options.nominalEdgeLimit);
-		rangeSensor = new SinglePingRangeSensor(evtCtx, options.objectInnerLimit, options.objectOuterLimit);
-		voltMeter = new VoltMeter(evtCtx);
-		locomotive = new Locomotive(evtCtx, options.defaultMotorSpeed);
+		edgeDetector = new EdgeDetector(evtCtx, sensors, options.nominalEdgeLimit);
+		if (options.numRangeSensors == 1)
+		{
+			rangeSensor = new SinglePingRangeSensor(evtCtx, sensors, options.objectInnerLimit, options.objectOuterLimit);
+		}
+		else
+		{
+			rangeSensor = new MultiPingRangeSensor(
+				evtCtx, sensors, RangeMounts, options.numRangeSensors, options.objectInnerLimit, options.objectOuterLimit
+			);
+		}
+		voltMeter = new VoltMeter(evtCtx, sensors, ADC_BATT_CHANNEL, ADC_BATT_DIVIDER, BatteryPack);
+		locomotive = new Locomotive(evtCtx, sensors, options.defaultMotorSpeed);
+		voltMeter->SetLocomotive(locomotive);
 
-		// register an input handler routine
+		// from here on a shutdown waits for the motors to stop
+		evtCtx.Register(&ShutdownMonitor);
+
+		// register an input handler routine, it also services latency dump requests
 		evtCtx.Register(&CheckInput);
+		signal(SIGUSR1, RequestLatencyDump);
 
 		// register a battery voltage monitoring routine
 		evtCtx.Register(&VoltageWatchdog);
@@ -386,20 +618,43 @@ void InitControlProgram(int argc, char* argv[], DP::EventContext& evtCtx)
 		else
 		{
 			// init State machine
-			Controller::Context ctx(*ui, *locomotive, *edgeDetector, *rangeSensor);
+			Controller::Context ctx(*ui, *locomotive, *edgeDetector, *rangeSensor, sensors);
 			switch(options.controllerMode)
 			{
 				case CM_ROAM:
 					controller = new RoamController(ctx, options.isVerbose);
-					evtCtx.Register(controller);
 					break;
 				case CM_GOTO_OBJECT:
 					controller = new GotoObjectController(ctx, options.isVerbose);
-					evtCtx.Register(controller);
 					break;
 				default:
 					assert(false);
 			}
+
+			// the controller and the locomotive are run by the pipeline, on the event loop
+			// until it is started
+			pipeline = new ControlPipeline(*locomotive);
+			pipeline->SetController(controller);
+			edgeDetector->SetEdgeHandler(pipeline);
+			locomotive->SetPipeline(pipeline);
+			evtCtx.Register(pipeline);
+		}
+
+		// after the threads started above, so that they keep the normal scheduler and every CPU
+		if (options.isRealtime)
+		{
+			EnterRealtime(stdout);
+			evtCtx.Register(&ControlJitter);
+		}
+
+		// and before the control thread, so that it shares the event loop's
+		if (options.isThreaded && pipeline)
+		{
+#ifdef SIM_BACKEND
+			// the threads only mean anything against a dpserver that keeps real time
+			evtCtx.SetRealTime(true);
+#endif
+			pipeline->Start();
 		}
 
 	} catch (DP::FrameworkException& e) {
@@ -414,33 +669,131 @@ void Shutdown()
 	Shutdown("", ERR_NONE);
 }
 
-// routine to properly shut down jefebot
+// routine to properly shut down jefebot; the motors are stopped at once, the rest is done
+// by FinishShutdown() once the stop is confirmed, which needs the event loop to keep running
 void Shutdown(const char* msg, int error)
 {
-	// stop moving if there is a locomotive
-	if (locomotive)
-		locomotive->Stop();
+	uint64_t request_ns = Profiler::Now_ns();
+
+	// stop moving if there is a locomotive, ahead of everything else; the pipeline has its
+	// control thread do it, if it has one.  The request is recorded first, so that a replay
+	// makes it where the recording did, ahead of the BREAKs
+	flightRecorder.Shutdown(error);
+	if (pipeline)
+		pipeline->EmergencyStop();
+	else if (locomotive)
+		locomotive->EmergencyStop();
+
+	if (shutdownRequest.isClaimed.exchange(true))
+		return;
+	shutdownRequest.msg = msg;
+	shutdownRequest.error = error;
+	shutdownRequest.request_ns = request_ns;
+	shutdownRequest.request_us = MonotonicTime_us();
+	shutdownRequest.isPending = true;
+
+	// without motors there is nothing to confirm
+	if (!locomotive)
+		FinishShutdown();
+}
+
+// complete a shutdown once the stop is confirmed or the confirmation has timed out
+static void FinishShutdown()
+{
+	// the control thread is done once the stop is, and the last of the log goes out before
+	// the report; a control thread that is stuck is left to itself, and the BREAKs it
+	// never made are written from here, the last resort
+	bool isControlStuck = pipeline && !pipeline->Stop();
+	if (isControlStuck)
+	{
+		printf("shutdown: the control thread did not stop, BREAK from the event loop\n");
+		locomotive->EmergencyStop();
+	}
+	logger.Stop();
+
+	bool isConfirmed = locomotive && locomotive->IsStopConfirmed();
+	// the BREAKs may have been written by the control thread, which is done by now
+	bool isHalted = locomotive && locomotive->IsHalted();
+	uint64_t break_ns = isHalted ? locomotive->GetHaltTime_ns() : 0;
+	uint64_t confirm_us = MonotonicTime_us() - shutdownRequest.request_us;
+	uint64_t teardown_ns = Profiler::Now_ns();
+	int error = shutdownRequest.error;
+	bool hasMotors = (locomotive != 0);
 
 	// clear LEDs
-	ui->Display(0);
+	if (ui)
+		ui->Display(0);
 
 	//shutdown any SPI or I2C devices
 
 	// display shutdown status message
 	if (error != ERR_NONE)
-		printf("%s: %s\nexiting...\n", msg, GetErrorMsg(error));
+		printf("%s: %s\nexiting...\n", shutdownRequest.msg, GetErrorMsg(error));
 	else
-		printf("%s\n", msg);
+		printf("%s\n", shutdownRequest.msg);
 
-	// allow dpserver to catch up
-    sleep(1);
+	// display where dead reckoning thinks the bot is
+	if (locomotive && options.isVerbose)
+	{
+		Pose pose;
+		locomotive->GetPose(&pose);
+		printf("pose: (%.1f, %.1f) cm +/- (%.1f, %.1f), heading %.2f +/- %.2f rad, odometer %.1f cm\n",
+			pose.x, pose.y, sqrtf(pose.covariance[0][0]), sqrtf(pose.covariance[1][1]),
+			pose.heading, sqrtf(pose.covariance[2][2]), pose.odometer);
+	}
 
-	// release all objects
+	// display what the edge sensors learned of the table
+	if (edgeDetector && options.isVerbose)
+		edgeDetector->PrintCalibration(stdout);
+
+	// display the latency histograms of a mission
+	if (!options.isTestMode)
+		edgeLatency.Print(stdout);
+	if (pipeline && (options.isThreaded || profiler.IsEnabled()))
+		pipeline->Print(stdout);
+	if (logger.GetNumDropped())
+		printf("logger: %lu lines dropped\n", logger.GetNumDropped());
+	telemetry.Print(stdout);
+
+	// display how steady the control period was
+	if (options.isRealtime)
+		controlJitter.Print(stdout, "control period");
+
+	// display the event handler profile and the time spent in each controller state
+	if (profiler.IsEnabled())
+	{
+		profiler.Print(stdout);
+		if (controller)
+			controller->PrintStateTimes(stdout);
+	}
+
+	// release all objects; the flight record is synced and the last sound finished alongside
+	// the peripherals, which go one after the other as they share the connection to dpserver
+	std::thread recorderTeardown([]() { flightRecorder.Close(); });
+	std::thread soundTeardown([]() { soundPlayer.Stop(); });
+	telemetry.Close();
     delete ui;
-    delete locomotive;
+    if (!isControlStuck)
+    {
+        delete pipeline;
+        delete locomotive;
+    }
     delete edgeDetector;
     delete rangeSensor;
     delete voltMeter;
+    recorderTeardown.join();
+    soundTeardown.join();
+
+	// how long the motors took to stop and jefebot to shut down
+	if (hasMotors)
+	{
+		if (isHalted)
+			printf("shutdown: BREAK %.1f uS after the request, ", (break_ns - shutdownRequest.request_ns) / 1e3);
+		else
+			printf("shutdown: BREAK NOT written, ");
+		printf("stop %s after %.0f mS, teardown %.1f mS\n", isConfirmed ? "confirmed" : "NOT confirmed",
+			confirm_us / 1e3, (Profiler::Now_ns() - teardown_ns) / 1e6);
+	}
 
     exit(error);
 }
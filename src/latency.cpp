@@ -0,0 +1,163 @@
+/*
+ *  latency.cpp
+ *
+ *  Description: Implementation of the latency histograms and the edge to stop probe
+ */
+
+#include <cmath>
+#include <algorithm>
+#include "clock.h"
+#include "latency.h"
+
+EdgeLatencyProbe edgeLatency;
+
+LatencyHistogram::LatencyHistogram()
+{
+	Clear();
+}
+
+void LatencyHistogram::Clear()
+{
+	for (unsigned i = 0; i < NumBuckets; ++i)
+		counts[i] = 0;
+	total = 0;
+	sum = 0;
+	min = UINT64_MAX;
+	max = 0;
+}
+
+unsigned LatencyHistogram::BucketOf(uint64_t value)
+{
+	if (value < LinearLimit)
+		return value;
+
+	// the octave from the top set bit, the sub-bucket from the 3 bits below it
+	unsigned octave = 63 - __builtin_clzll(value);
+	if (octave >= 32)
+		return NumBuckets - 1;
+	unsigned sub = (value >> (octave - 3)) & (SubBuckets - 1);
+	return LinearLimit + (octave - 4) * SubBuckets + sub;
+}
+
+uint64_t LatencyHistogram::BucketLow(unsigned bucket)
+{
+	if (bucket < LinearLimit)
+		return bucket;
+
+	unsigned octave = 4 + (bucket - LinearLimit) / SubBuckets;
+	unsigned sub = (bucket - LinearLimit) % SubBuckets;
+	return ((uint64_t)(SubBuckets + sub)) << (octave - 3);
+}
+
+void LatencyHistogram::Record(uint64_t value)
+{
+	++counts[BucketOf(value)];
+	++total;
+	sum += value;
+	if (value < min)
+		min = value;
+	if (value > max)
+		max = value;
+}
+
+uint64_t LatencyHistogram::Percentile(double fraction) const
+{
+	if (total == 0)
+		return 0;
+
+	// the nearest rank, 1 based, so that p99 of fewer than 100 values is the largest
+	unsigned long rank = (unsigned long)ceil(fraction * total);
+	unsigned long seen = 0;
+
+	if (rank < 1)
+		rank = 1;
+	for (unsigned i = 0; i + 1 < NumBuckets; ++i)
+	{
+		seen += counts[i];
+		if (seen >= rank)
+			return std::min(std::max(BucketLow(i + 1) - 1, min), max);
+	}
+	return max;
+}
+
+void LatencyHistogram::Print(FILE* fp, const char* name) const
+{
+	if (total == 0)
+	{
+		fprintf(fp, "%s: no samples\n", name);
+		return;
+	}
+
+	fprintf(fp, "%s: n=%lu min=%llu mean=%llu p50=%llu p90=%llu p99=%llu max=%llu uS\n",
+		name, total, (unsigned long long)min, (unsigned long long)(sum / total),
+		(unsigned long long)Percentile(0.50), (unsigned long long)Percentile(0.90),
+		(unsigned long long)Percentile(0.99), (unsigned long long)max);
+	for (unsigned i = 0; i < NumBuckets; ++i)
+	{
+		if (counts[i])
+		{
+			fprintf(fp, "    >= %8llu uS: %u\n", (unsigned long long)BucketLow(i), counts[i]);
+		}
+	}
+}
+
+EdgeLatencyProbe::EdgeLatencyProbe() : stage(IDLE), sampleTime_us(0), decisionTime_us(0)
+{
+}
+
+// the sample time is only written while IDLE, so whoever moves the stage on may read it
+void EdgeLatencyProbe::EdgeSampled()
+{
+	if (stage.load(std::memory_order_acquire) == IDLE)
+	{
+		sampleTime_us = MonotonicTime_us();
+		stage.store(SAMPLED, std::memory_order_release);
+	}
+}
+
+void EdgeLatencyProbe::EdgeCleared()
+{
+	// the edge went away without anyone acting on it
+	STAGE expected = SAMPLED;
+	stage.compare_exchange_strong(expected, IDLE, std::memory_order_acq_rel);
+}
+
+// the decision time is written only while SAMPLED, when nobody reads it, and before the
+// stage says it is there, so Stopped() on another thread never sees it stale
+void EdgeLatencyProbe::EdgeDecided()
+{
+	STAGE expected = SAMPLED;
+	uint64_t now = MonotonicTime_us();
+
+	if (stage.load(std::memory_order_acquire) != SAMPLED)
+		return;
+	decisionTime_us.store(now, std::memory_order_relaxed);
+	if (stage.compare_exchange_strong(expected, DECIDED, std::memory_order_acq_rel))
+	{
+		sampleToDecision.Record(now - sampleTime_us);
+	}
+}
+
+void EdgeLatencyProbe::Stopped()
+{
+	if (stage.load(std::memory_order_acquire) == DECIDED)
+	{
+		uint64_t now = MonotonicTime_us();
+		uint64_t decisionToStop_us = now - decisionTime_us.load(std::memory_order_relaxed);
+		uint64_t sampleToStop_us = now - sampleTime_us;
+		STAGE expected = DECIDED;
+
+		if (stage.compare_exchange_strong(expected, IDLE, std::memory_order_acq_rel))
+		{
+			decisionToStop.Record(decisionToStop_us);
+			sampleToStop.Record(sampleToStop_us);
+		}
+	}
+}
+
+void EdgeLatencyProbe::Print(FILE* fp) const
+{
+	sampleToDecision.Print(fp, "edge sample to decision");
+	decisionToStop.Print(fp, "edge decision to stop");
+	sampleToStop.Print(fp, "edge sample to stop");
+}
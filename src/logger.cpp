@@ -0,0 +1,136 @@
+/*
+ *  logger.cpp
+ *
+ *  Description: Implementation of the logger
+ */
+
+#include <cstdarg>
+#include <cstring>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include "logger.h"
+
+Logger logger;
+
+// the ring of the calling thread, claimed in the generation of the logger it was claimed in
+static thread_local struct
+{
+	unsigned generation;
+	int ring;
+} threadRing = {0, -1};
+
+static std::atomic<unsigned> generation(0);
+
+Logger::Logger() : fp(stdout), isStarted(false), isStopping(false), numRings(0), numDropped(0)
+{
+	sem_init(&pending, 0, 0);
+}
+
+Logger::~Logger()
+{
+	Stop();
+	sem_destroy(&pending);
+}
+
+void Logger::Start()
+{
+	if (IsStarted())
+		return;
+
+	// rings claimed by threads of an earlier start may belong to threads that are gone
+	numRings.store(0, std::memory_order_relaxed);
+	generation.fetch_add(1, std::memory_order_relaxed);
+	isStopping = false;
+	worker = std::thread(&Logger::Work, this);
+	isStarted.store(true, std::memory_order_release);
+}
+
+void Logger::Stop()
+{
+	if (!IsStarted())
+		return;
+
+	// the worker writes whatever is queued before it sees the stop
+	isStarted.store(false, std::memory_order_release);
+	isStopping = true;
+	sem_post(&pending);
+	worker.join();
+}
+
+int Logger::ClaimRing()
+{
+	unsigned current = generation.load(std::memory_order_relaxed);
+
+	if (threadRing.generation != current)
+	{
+		unsigned n = numRings.fetch_add(1, std::memory_order_relaxed);
+		threadRing.generation = current;
+		threadRing.ring = (n < MaxThreads) ? (int)n : -1;
+	}
+	return threadRing.ring;
+}
+
+void Logger::Print(const char* format, ...)
+{
+	va_list args;
+	int ring = IsStarted() ? ClaimRing() : -1;
+
+	va_start(args, format);
+	if (ring < 0)
+	{
+		vfprintf(fp, format, args);
+		fflush(fp);
+	}
+	else
+	{
+		Line line;
+		int length = vsnprintf(line.text, MaxLine, format, args);
+
+		line.length = (length < 0) ? 0 : length;
+		if (line.length >= MaxLine)
+		{
+			// a line cut short still ends the line
+			line.length = MaxLine - 1;
+			line.text[MaxLine - 2] = '\n';
+		}
+
+		if (rings[ring].Push(line))
+			sem_post(&pending);
+		else
+			numDropped.fetch_add(1, std::memory_order_relaxed);
+	}
+	va_end(args);
+}
+
+void Logger::Work()
+{
+	// only ever run when nothing else wants the CPU, even if started from a real-time thread
+	struct sched_param param;
+	memset(&param, 0, sizeof(param));
+	pthread_setschedparam(pthread_self(), SCHED_OTHER, &param);
+	setpriority(PRIO_PROCESS, syscall(SYS_gettid), WorkerNice);
+
+	for (;;)
+	{
+		while (sem_wait(&pending) < 0)
+			;
+
+		// one post per line plus one for the stop, so the rings drain first
+		Line line;
+		bool isPopped = false;
+		for (unsigned i = 0; i < MaxThreads && !isPopped; ++i)
+			isPopped = rings[i].Pop(&line);
+
+		if (isPopped)
+		{
+			fwrite(line.text, 1, line.length, fp);
+			fflush(fp);
+		}
+		else if (isStopping)
+		{
+			break;
+		}
+	}
+}
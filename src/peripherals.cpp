@@ -11,10 +11,19 @@
  */
 
 #include <cstdio>
+#include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <cstring>
 #include <dp_events.h>
 #include <dp_peripherals.h>
+#include "clock.h"
 #include "peripherals.h"
+#include "latency.h"
+#include "profiler.h"
+#include "flight_recorder.h"
+#include "telemetry.h"
+#include "pipeline.h"
 
 UserInterface::UserInterface(DP::EventContext& evtCtx) : DP::BB4IO(evtCtx)
 {
@@ -22,8 +31,18 @@ UserInterface::UserInterface(DP::EventContext& evtCtx) : DP::BB4IO(evtCtx)
 	StartDataStream();
 }
 
-Locomotive::Locomotive(DP::EventContext& evtCtx, float _defaultSpeed) :
-	DP::COUNT4(evtCtx, COUNT4_IDX), DP::DC2(evtCtx, DC2_IDX), direction(STOP), defaultSpeed(_defaultSpeed)
+void UserInterface::Handler()
+{
+	PROFILE_CALLBACK("UserInterface::Handler", 0);
+
+	DP::BB4IO::Handler();
+}
+
+Locomotive::Locomotive(DP::EventContext& evtCtx, SensorFrameBuffer& _sensors, float _defaultSpeed) :
+	DP::COUNT4(evtCtx, COUNT4_IDX), DP::DC2(evtCtx, DC2_IDX), direction(STOP), defaultSpeed(_defaultSpeed),
+	isMoving(false), moveBegin(0.0), isTurning(false), turnBegin(0.0),
+	numMotionSegments(0), motionSegment(0), segmentBegin(0.0), segmentProgress(0.0), motionHandler(0),
+	isHaltRequested(false), isHalted(false), haltTime_ns(0), isStopConfirmed(false), sensors(_sensors), pipeline(0)
 {
 	// sanity check for default speed
 	if (MinSpeed > defaultSpeed || defaultSpeed > MaxSpeed)
@@ -31,8 +50,12 @@ Locomotive::Locomotive(DP::EventContext& evtCtx, float _defaultSpeed) :
 		throw DP::FrameworkException("Locomotive speed", ERR_PARAMS);
 	}
 
-	// initialize the continuous tick counters
+	// initialize the pose, the continuous tick counters, the cached motor settings and the PIDs
+	memset(&pose, 0, sizeof(pose));
 	ClearTicks();
+	modes[LEFT] = modes[RIGHT] = BREAK;
+	powers[LEFT] = powers[RIGHT] = 0.0;
+	ResetRegulators();
 
 	// register and configure the DP Count4 peripheral
 	evtCtx.Register(this);
@@ -49,18 +72,76 @@ Locomotive::Locomotive(DP::EventContext& evtCtx, float _defaultSpeed) :
 
 void Locomotive::ClearTicks()
 {
+	const unsigned counts[2] = {0, 0};
+	const float intervals[2] = {0.0, 0.0};
+
 	ticks[0] = ticks[1] = 0;
+	PublishOdometry(counts, intervals);
+}
+
+void Locomotive::PublishOdometry(const unsigned counts[2], const float intervals[2])
+{
+	sensors.PublishOdometry(ticks, counts, intervals, pose);
+}
 
+void Locomotive::UpdatePose(int deltaL, int deltaR)
+{
+	float dl = (float)deltaL / TicksPerCM;
+	float dr = (float)deltaR / TicksPerCM;
+	float ds = (dl + dr) / 2;
+	float dtheta = (dr - dl) / WheelBase;
+
+	// integrate along the arc's mean heading
+	float theta = pose.heading + dtheta / 2;
+	float c = cosf(theta);
+	float s = sinf(theta);
+	pose.x += ds * c;
+	pose.y += ds * s;
+	pose.heading = remainderf(pose.heading + dtheta, 2 * M_PI);
+	pose.odometer += fabsf(ds);
+	pose.rotation += fabsf(dtheta);
+
+	// propagate the covariance: P = Fx P Fx' + Fu Q Fu', where Fx and Fu are the
+	// Jacobians of the update with respect to the pose and to the wheel travels, and Q
+	// grows with the distance each wheel rolled
+	float Fx[3][3] = {{1, 0, -ds * s}, {0, 1, ds * c}, {0, 0, 1}};
+	float Fu[3][2] =
+	{
+		{c / 2 + ds * s / (2 * WheelBase), c / 2 - ds * s / (2 * WheelBase)},
+		{s / 2 - ds * c / (2 * WheelBase), s / 2 + ds * c / (2 * WheelBase)},
+		{-1 / WheelBase, 1 / WheelBase}
+	};
+	float Q[2] = {WheelVariance * fabsf(dl), WheelVariance * fabsf(dr)};
+	float FP[3][3];
+	float P[3][3];
+
+	for (int i = 0; i < 3; ++i)
+		for (int j = 0; j < 3; ++j)
+			FP[i][j] = Fx[i][0] * pose.covariance[0][j] + Fx[i][1] * pose.covariance[1][j] + Fx[i][2] * pose.covariance[2][j];
+	for (int i = 0; i < 3; ++i)
+		for (int j = 0; j < 3; ++j)
+			P[i][j] =
+				FP[i][0] * Fx[j][0] + FP[i][1] * Fx[j][1] + FP[i][2] * Fx[j][2] +
+				Fu[i][0] * Q[0] * Fu[j][0] + Fu[i][1] * Q[1] * Fu[j][1];
+	memcpy(pose.covariance, P, sizeof(P));
 }
 void Locomotive::SetMode(char modeL, char modeR)
 {
+	if (CheckHalt())
+		return;
+
 	SetMode0(modes[LEFT] = modeL);
 	SetMode1(modes[RIGHT] = modeR);
+	flightRecorder.MotorMode(modeL, modeR);
+	telemetry.MotorMode(modeL, modeR);
 }
 
 void Locomotive::SetPower(float powerL, float powerR)
 {
-	if ((MinSpeed <= powerL && powerL <= MaxSpeed) && (MinSpeed <= powerR || powerR <= MaxSpeed))
+	if (CheckHalt())
+		return;
+
+	if ((MinSpeed <= powerL && powerL <= MaxSpeed) && (MinSpeed <= powerR && powerR <= MaxSpeed))
     {
 	    if (powers[LEFT] != powerL)
 	    {
@@ -70,64 +151,195 @@ void Locomotive::SetPower(float powerL, float powerR)
 	    {
 	        SetPower1(powers[RIGHT] = powerR);
 	    }
+	    flightRecorder.MotorPower(powerL, powerR);
+	    telemetry.MotorPower(powerL, powerR);
     }
 }
 
 void Locomotive::Stop()
 {
+    CancelMotion();
     direction = STOP;
     SetMode(BREAK, BREAK);
+    edgeLatency.Stopped();
+    ResetRegulators();
     SetPower(defaultSpeed, defaultSpeed);
 }
 
+void Locomotive::EmergencyStop()
+{
+	// the BREAKs go out first, straight to the DC2
+	SetMode0(BREAK);
+	SetMode1(BREAK);
+	uint64_t break_ns = Profiler::Now_ns();
+	edgeLatency.Stopped();
+
+	if (isHalted)
+		return;
+	haltTime_ns = break_ns;
+	isHalted = true;
+	modes[LEFT] = modes[RIGHT] = BREAK;
+	direction = STOP;
+	numMotionSegments = motionSegment = 0;
+	motionHandler = 0;
+	flightRecorder.MotorMode(BREAK, BREAK);
+	telemetry.MotorMode(BREAK, BREAK);
+}
+
+bool Locomotive::CheckHalt()
+{
+	if (!isHalted && isHaltRequested.load(std::memory_order_acquire))
+		EmergencyStop();
+	return isHalted;
+}
+
+void Locomotive::SetDirection(enum DIRECTION newDirection, char modeL, char modeR)
+{
+	// a new movement starts from the default power with fresh regulators, repeating the
+	// current one leaves them alone
+	if (direction != newDirection)
+	{
+		ResetRegulators();
+		SetPower(defaultSpeed, defaultSpeed);
+	}
+    direction = newDirection;
+    SetMode(modeL, modeR);
+}
+
 void Locomotive::MoveForward()
 {
-    direction = MOVE_FORWARD;
-    SetMode(FORWARD, FORWARD);
+    CancelMotion();
+    SetDirection(MOVE_FORWARD, FORWARD, FORWARD);
 }
 
 void Locomotive::MoveReverse()
 {
-    direction = MOVE_REVERSE;
-    SetMode(REVERSE, REVERSE);
+    CancelMotion();
+    SetDirection(MOVE_REVERSE, REVERSE, REVERSE);
 }
 
 void Locomotive::SpinCW()
 {
-    direction = SPIN_CW;
-    SetMode(FORWARD, REVERSE);
+    CancelMotion();
+    SetDirection(SPIN_CW, FORWARD, REVERSE);
 }
 
 void Locomotive::SpinCCW()
 {
-    direction = SPIN_CCW;
-    SetMode(REVERSE, FORWARD);
+    CancelMotion();
+    SetDirection(SPIN_CCW, REVERSE, FORWARD);
 }
 
-bool Locomotive::HasMovedDistance(unsigned distanceInCm, unsigned* pCurDistance)
+void Locomotive::Submit(const MotionSegment* segments, unsigned count, MotionHandler* handler)
+{
+	if (count == 0 || count > MaxMotionSegments)
+	{
+		throw DP::FrameworkException("Locomotive motion", ERR_PARAMS);
+	}
+
+	// nothing moves after an emergency stop
+	if (CheckHalt())
+		return;
+
+	for (unsigned i = 0; i < count; ++i)
+	{
+		motionSegments[i] = segments[i];
+	}
+	numMotionSegments = count;
+	motionSegment = 0;
+	motionHandler = handler;
+	StartMotionSegment();
+}
+
+void Locomotive::CancelMotion()
+{
+	numMotionSegments = 0;
+	motionSegment = 0;
+	motionHandler = 0;
+}
+
+void Locomotive::StartMotionSegment()
 {
-	static bool isMoving = false;
-	static int beginTicks = 0;
-	int targetTicks = distanceInCm * TicksPerCM;
-	int ticks = (direction == MOVE_FORWARD) ? GetTicks(RIGHT) : -GetTicks(RIGHT);
+	const MotionSegment& segment = motionSegments[motionSegment];
+
+	switch (segment.motion)
+	{
+		case MOTION_FORWARD:
+			SetDirection(MOVE_FORWARD, FORWARD, FORWARD);
+			break;
+		case MOTION_REVERSE:
+			SetDirection(MOVE_REVERSE, REVERSE, REVERSE);
+			break;
+		case MOTION_SPIN_CW:
+			SetDirection(SPIN_CW, FORWARD, REVERSE);
+			break;
+		case MOTION_SPIN_CCW:
+			SetDirection(SPIN_CCW, REVERSE, FORWARD);
+			break;
+	}
+	segmentBegin = (direction == SPIN_CW || direction == SPIN_CCW) ? pose.rotation : pose.odometer;
+	segmentProgress = segmentBegin;
+
+	// an open ended last segment completes the sequence as soon as it starts
+	if (segment.amount == 0.0 && motionSegment == numMotionSegments - 1)
+	{
+		MotionHandler* handler = motionHandler;
+		CancelMotion();
+		if (handler)
+		{
+			handler->OnMotionComplete();
+		}
+	}
+}
+
+void Locomotive::RunMotion()
+{
+	const MotionSegment& segment = motionSegments[motionSegment];
+	float progress = (direction == SPIN_CW || direction == SPIN_CCW) ? pose.rotation : pose.odometer;
+	float step = progress - segmentProgress;
+
+	// end the segment on the update nearest its amount rather than the first one past it,
+	// which halves the average overshoot
+	segmentProgress = progress;
+	if (segment.amount == 0.0 || progress - segmentBegin + step / 2 < segment.amount)
+	{
+		return;
+	}
 
+	// go straight on to the next segment, or stop at the end of the sequence
+	if (++motionSegment < numMotionSegments)
+	{
+		StartMotionSegment();
+	}
+	else
+	{
+		MotionHandler* handler = motionHandler;
+		Stop();
+		if (handler)
+		{
+			handler->OnMotionComplete();
+		}
+	}
+}
+
+bool Locomotive::HasMovedDistance(unsigned distanceInCm, unsigned* pCurDistance)
+{
+	// establish the beginning odometer reading if necessary
 	if (!isMoving)
 	{
-		beginTicks = ticks;
+		moveBegin = pose.odometer;
 		isMoving = true;
 	}
 
 	// set the current distance
+	float distance = pose.odometer - moveBegin;
 	if (pCurDistance)
 	{
-		*pCurDistance = ticks / TicksPerCM;
+		*pCurDistance = distance;
 	}
 
-	// debug print
-	//printf("target ticks = %d, begin ticks = %d, ticks = %d\n", targetTicks, beginTicks, ticks);
-
 	// return true if the distance has been met and cancel a distance measurement
-	if (ticks - beginTicks >= targetTicks)
+	if (distance >= distanceInCm)
 	{
 		isMoving = false;
 		return true;
@@ -138,29 +350,22 @@ bool Locomotive::HasMovedDistance(unsigned distanceInCm, unsigned* pCurDistance)
 
 bool Locomotive::HasTurnedAngle(float angleInRadians, float* pCurAngle)
 {
-	static bool isTurning = false;
-	static int beginTicks = 0;
-	int targetTicks = angleInRadians * TicksPerRadian;
-	int ticks = GetTicks((direction == SPIN_CW) ? LEFT : RIGHT);
-
-	// establish the beginning tick count if necessary
+	// establish the beginning rotation if necessary
 	if (!isTurning)
 	{
-		beginTicks = ticks;
+		turnBegin = pose.rotation;
 		isTurning = true;
 	}
 
 	// set the current angle
+	float angle = pose.rotation - turnBegin;
 	if (pCurAngle)
 	{
-		*pCurAngle = ticks / TicksPerRadian;
+		*pCurAngle = angle;
 	}
 
-	// debug print
-	//printf("target ticks = %d, begin ticks = %d, ticks = %d\n", targetTicks, beginTicks, ticks);
-
 	// return true if the angle has been met and cancel an angle measurement
-	if (ticks - beginTicks >= targetTicks)
+	if (angle >= angleInRadians)
 	{
 		isTurning = false;
 		return true;
@@ -169,81 +374,292 @@ bool Locomotive::HasTurnedAngle(float angleInRadians, float* pCurAngle)
 	return false;
 }
 
-#define P_LOOP
 void Locomotive::Handler()
 {
+	PROFILE_CALLBACK("Locomotive::Handler", Count4Period);
+
 	// call the counter's handler to get the current values
 	DP::COUNT4::Handler();
 
-    // accumulate the ticks
-    ticks[LEFT] += (GetMode(LEFT) == FORWARD) ? GetCount(LEFT) : -GetCount(LEFT);
-    ticks[RIGHT] += (GetMode(RIGHT) == FORWARD) ? GetCount(RIGHT) : -GetCount(RIGHT);
+	unsigned counts[2] = {GetCount(LEFT), GetCount(RIGHT)};
+	float intervals[2] = {GetInterval(LEFT), GetInterval(RIGHT)};
+	if (pipeline)
+		pipeline->Odometry(counts, intervals);
+	else
+		Update(counts, intervals);
+}
+
+void Locomotive::Update(const unsigned counts[2], const float intervals[2])
+{
+    // accumulate the ticks and dead reckon the pose from them
+    int deltaL = (GetMode(LEFT) == FORWARD) ? counts[LEFT] : -counts[LEFT];
+    int deltaR = (GetMode(RIGHT) == FORWARD) ? counts[RIGHT] : -counts[RIGHT];
+    ticks[LEFT] += deltaL;
+    ticks[RIGHT] += deltaR;
+    UpdatePose(deltaL, deltaR);
+    PublishOdometry(counts, intervals);
+    flightRecorder.Odometry(LEFT, counts[LEFT], intervals[LEFT], ticks[LEFT]);
+    flightRecorder.Odometry(RIGHT, counts[RIGHT], intervals[RIGHT], ticks[RIGHT]);
+
+    // after an emergency stop, the encoders confirm the BREAKs took effect
+    if (isHalted && counts[LEFT] == 0 && counts[RIGHT] == 0)
+    {
+    	isStopConfirmed = true;
+    }
+
+    // advance a motion sequence as soon as the encoders show a segment is complete
+    if (IsMotionPending())
+    {
+    	RunMotion();
+    }
 
     // PID controller
 
-    if (direction == MOVE_FORWARD && GetInterval(LEFT) != 0 && GetInterval(RIGHT) != 0)
+    // in every moving direction both wheels turn at the same speed, so each wheel is
+    // regulated to the mean of the two; defaultSpeed feeds forward the pace
+    if (direction != STOP)
     {
-    	// calculate the velocity of each motor
-		unsigned countL = GetCount(LEFT);
-		float intvlL = GetInterval(LEFT);
-    	float vl = countL / intvlL;
-		unsigned countR = GetCount(RIGHT);
-		float intvlR = GetInterval(RIGHT);
-		float vr = countR / intvlR;
-
-		// TODO: are anomalous velocities an issue with the Count4 peripheral (due to bad intervals)???
-		// determine the velocity error and filter out anomalies
-		float err = vl - vr;
-		if (-MaxVelocityErr > err || err > MaxVelocityErr)
-		{
-			return;
-		}
+		float vl = GetVelocity(counts[LEFT], intervals[LEFT]);
+		float vr = GetVelocity(counts[RIGHT], intervals[RIGHT]);
+		float target = (vl + vr) / 2;
 
-		// calculate the proportional component of the power adjustment
-		float P = Kp * err;
-		// debug pring
-		//printf("Velocity: LEFT: %u ticks / %f sec = %f t/s  RIGHT: %u ticks / %f sec = %f t/s   err = %f, P = %f\n", countL, intvlL, vl, countR, intvlR, vr, err, P);
-
-		// TODO: I and D components must be calculated per-motor
-		// for now calculate the power adjustment solely based on the proportional component
-		float powerL = GetPower(LEFT);
-		float powerR = GetPower(RIGHT);
-		float adjL = (P/2) * powerL;
-		float adjR = (P/2) * powerR;
-		float newPwrL = powerL - adjL;
-		float newPwrR = powerR - adjR;
-		// debug print
-		//printf("Power: LEFT: %f - %f = %f  RIGHT: %f - %f = %f \n", powerL, adjL, newPwrL, powerR, adjL, newPwrL);
-		SetPower(newPwrL, newPwrR);
+		SetPower(Regulate(LEFT, target, vl), Regulate(RIGHT, target, vr));
     }
 }
 
-SinglePingRangeSensor::SinglePingRangeSensor(DP::EventContext& evtCtx, int _innerLimit, int _outerLimit) :
-	DP::PING4(evtCtx, PING4_IDX), innerLimit(_innerLimit), outerLimit(_outerLimit)
+float Locomotive::GetVelocity(unsigned count, float interval)
+{
+	// the interval spans the counted edges; without one, fall back on the update period
+	if (interval <= 0.0)
+	{
+		interval = Count4Period / 1000.0;
+	}
+
+	return count / interval;
+}
+
+float Locomotive::Regulate(int side, float target, float velocity)
+{
+	SpeedRegulator& r = regulators[side];
+	const float dt = Count4Period / 1000.0;
+	float error = target - velocity;
+
+	// derivative of the measurement rather than the error so a new target gives no kick,
+	// low pass filtered as it differentiates the encoder quantization noise
+	if (r.isPrimed)
+	{
+		float rate = (velocity - r.prevVelocity) / dt;
+		r.derivative += (rate - r.derivative) * (dt / (DerivativeFilterTau + dt));
+	}
+	r.prevVelocity = velocity;
+	r.isPrimed = true;
+
+	float P = Kp * error;
+	float D = -Kd * r.derivative;
+	float integral = r.integral + Ki * error * dt;
+	float power = defaultSpeed + P + integral + D;
+
+	// clamp to the motor limits and, to prevent windup, only keep integrating while the
+	// output is not held at a limit by the integral itself
+	if (power > MaxSpeed)
+	{
+		power = MaxSpeed;
+		if (error < 0.0)
+			r.integral = integral;
+	}
+	else if (power < MinSpeed)
+	{
+		power = MinSpeed;
+		if (error > 0.0)
+			r.integral = integral;
+	}
+	else
+	{
+		r.integral = integral;
+	}
+
+	// the integral alone may never use more than the whole output range
+	if (r.integral > MaxSpeed - MinSpeed)
+		r.integral = MaxSpeed - MinSpeed;
+	else if (r.integral < MinSpeed - MaxSpeed)
+		r.integral = MinSpeed - MaxSpeed;
+
+	flightRecorder.SpeedError(side, error, power - defaultSpeed);
+	telemetry.SpeedError(side, error, power - defaultSpeed);
+	return power;
+}
+
+void Locomotive::ResetRegulators()
+{
+	for (int i = 0; i < 2; ++i)
+	{
+		regulators[i].integral = 0.0;
+		regulators[i].derivative = 0.0;
+		regulators[i].prevVelocity = 0.0;
+		regulators[i].isPrimed = false;
+	}
+}
+
+MultiPingRangeSensor::MultiPingRangeSensor(
+	DP::EventContext& evtCtx,
+	SensorFrameBuffer& _sensors,
+	const Mount* _mounts,
+	unsigned _numSensors,
+	int _innerLimit,
+	int _outerLimit
+) :
+	DP::PING4(evtCtx, PING4_IDX), numSensors(_numSensors), numSlots(0), slot(0),
+	innerLimit(_innerLimit), outerLimit(_outerLimit), sensors(_sensors)
 {
 	if (
+		numSensors == 0 || numSensors > MaxSensors ||
 		MinRange > innerLimit || innerLimit > MaxRange ||
 		MinRange > outerLimit || outerLimit > MaxRange
 	)
     {
-    	throw DP::FrameworkException("SinglePingRangeSensor", ERR_PARAMS);
+    	throw DP::FrameworkException("MultiPingRangeSensor", ERR_PARAMS);
     }
+	for (unsigned i = 0; i < numSensors; ++i)
+	{
+		for (unsigned j = 0; j < i; ++j)
+		{
+			if (_mounts[j].sensor == _mounts[i].sensor)
+			{
+				throw DP::FrameworkException("MultiPingRangeSensor", ERR_PARAMS);
+			}
+		}
+		mounts[i] = _mounts[i];
+	}
+
+	// fill each slot in turn with every sensor left that is far enough from all of those in it
+	unsigned unassigned = (1u << numSensors) - 1;
+	while (unassigned)
+	{
+		unsigned mask = 0;
+		for (unsigned i = 0; i < numSensors; ++i)
+		{
+			if (!(unassigned & (1u << i)))
+				continue;
+			bool isClear = true;
+			for (unsigned j = 0; j < numSensors; ++j)
+			{
+				if ((mask & (1u << j)) && fabsf(remainderf(mounts[i].angle - mounts[j].angle, 2*M_PI)) < MinSeparation)
+					isClear = false;
+			}
+			if (isClear)
+				mask |= (1u << i);
+		}
+		slots[numSlots++] = mask;
+		unassigned &= ~mask;
+	}
 
 	evtCtx.Register(this);
-	Enable(SENSOR_0);
+	Fire(0);
 	StartDataStream();
 }
 
+void MultiPingRangeSensor::Fire(unsigned nextSlot)
+{
+	slot = nextSlot;
+	for (unsigned i = 0; i < numSensors; ++i)
+	{
+		if (slots[slot] & (1u << i))
+			Enable(mounts[i].sensor);
+		else
+			Disable(mounts[i].sensor);
+	}
+}
+
+void MultiPingRangeSensor::Handler()
+{
+	PROFILE_CALLBACK("RangeSensor::Handler", 0);
+
+	DP::PING4::Handler();
+
+	unsigned fired = slots[slot];
+	unsigned distances[MaxSensors];
+	for (unsigned i = 0; i < numSensors; ++i)
+	{
+		distances[i] = DP::PING4::GetDistance(mounts[i].sensor);
+		if (fired & (1u << i))
+			flightRecorder.Range(mounts[i].sensor, distances[i]);
+	}
+	sensors.PublishRanges(fired, distances);
+
+	// the next slot fires while this one's echoes die away
+	if (numSlots > 1)
+	{
+		Fire((slot + 1) % numSlots);
+	}
+}
+
+bool MultiPingRangeSensor::GetNearest(const SensorFrame& frame, float maxAngle, unsigned* pDistance, float* pAngle) const
+{
+	bool isFound = false;
+
+	for (unsigned i = 0; i < numSensors; ++i)
+	{
+		if (frame.rangeTimes_us[i] == 0 || fabsf(mounts[i].angle) > maxAngle)
+			continue;
+		if (!isFound || frame.ranges[i] < *pDistance)
+		{
+			isFound = true;
+			*pDistance = frame.ranges[i];
+			if (pAngle)
+				*pAngle = mounts[i].angle;
+		}
+	}
+
+	return isFound;
+}
+
+float MultiPingRangeSensor::GetScanAngle() const
+{
+	float angles[MaxSensors];
+	float maxGap = 0.0;
+
+	// the widest gap between neighbouring sensors, going round the circle
+	for (unsigned i = 0; i < numSensors; ++i)
+		angles[i] = remainderf(mounts[i].angle, 2*M_PI);
+	std::sort(angles, angles + numSensors);
+	for (unsigned i = 0; i < numSensors; ++i)
+	{
+		float gap = (i + 1 < numSensors) ? angles[i + 1] - angles[i] : angles[0] + 2*M_PI - angles[i];
+		if (gap > maxGap)
+			maxGap = gap;
+	}
+
+	return maxGap;
+}
+
+const MultiPingRangeSensor::Mount SinglePingRangeSensor::Nose = {SENSOR_0, 0.0};
+
+constexpr SharpDistanceTable::Point SharpDistanceTable::Curve[];
+constexpr SharpDistanceTable EdgeDetector::DistanceTable;
+
 // TODO: change class name to the specific brand/type of sensor
-EdgeDetector::EdgeDetector(DP::EventContext& evtCtx, unsigned nominalEdgeLimit) : DP::ADC812(evtCtx, ADC812_IDX)
+EdgeDetector::EdgeDetector(DP::EventContext& evtCtx, SensorFrameBuffer& _sensors, unsigned _nominalEdgeLimit) :
+	DP::ADC812(evtCtx, ADC812_IDX), nominalEdgeLimit(_nominalEdgeLimit), numSamples(0), sensors(_sensors), edgeHandler(0)
 {
 	if (MinEdgeRange > nominalEdgeLimit || nominalEdgeLimit > MaxEdgeRange)
     {
-    	throw DP::FrameworkException("SinglePingRangeSensor", ERR_PARAMS);
+    	throw DP::FrameworkException("EdgeDetector", ERR_PARAMS);
     }
 	for (int i = 0; i < 3; ++i)
 	{
-		edgeLimits[i] = nominalEdgeLimit;
+		Channel& channel = channels[i];
+		for (unsigned n = 0; n < MedianLength; ++n)
+			channel.history[n] = 0;
+		channel.edgeLimit = nominalEdgeLimit;
+#ifdef USE_DISTANCE_NOT_VOLTAGE
+		channel.clearLimit = nominalEdgeLimit - MinHysteresis;
+#else
+		channel.clearLimit = nominalEdgeLimit + MinHysteresis;
+#endif
+		channel.isAtEdge = false;
+		channel.numSamples = 0;
+		channel.mean = 0.0;
+		channel.m2 = 0.0;
 	}
 
 	evtCtx.Register(this);
@@ -251,6 +667,160 @@ EdgeDetector::EdgeDetector(DP::EventContext& evtCtx, unsigned nominalEdgeLimit)
 	StartDataStream();
 }
 
+// the median of the channel's last samples, the history is primed with the first one
+unsigned EdgeDetector::Filter(Channel& channel, unsigned sample)
+{
+	unsigned window[MedianLength];
+
+	for (unsigned n = MedianLength - 1; n > 0; --n)
+		channel.history[n] = (numSamples == 0) ? sample : channel.history[n - 1];
+	channel.history[0] = sample;
+
+	for (unsigned n = 0; n < MedianLength; ++n)
+		window[n] = channel.history[n];
+	std::nth_element(window, window + MedianLength / 2, window + MedianLength);
+	return window[MedianLength / 2];
+}
+
+// add a sample of the table surface to the channel's running mean and variance
+void EdgeDetector::Calibrate(Channel& channel, unsigned sample_mV)
+{
+	// a sample that is already an edge is not the surface
+#ifdef USE_DISTANCE_NOT_VOLTAGE
+	unsigned sample = ToDistance_cm(sample_mV);
+	if (sample + MinHysteresis > nominalEdgeLimit)
+		return;
+#else
+	unsigned sample = sample_mV;
+	if (sample < nominalEdgeLimit + MinHysteresis)
+		return;
+#endif
+
+	float delta = sample - channel.mean;
+	++channel.numSamples;
+	channel.mean += delta / channel.numSamples;
+	channel.m2 += delta * (sample - channel.mean);
+}
+
+void EdgeDetector::EndCalibration(Channel& channel)
+{
+	float noise = GetNoise((EDGE_SENSORS)(&channel - channels));
+	float margin = fmaxf(EdgeMarginSigmas * noise, MinEdgeMargin * channel.mean);
+	float hysteresis = fmaxf(HysteresisSigmas * noise, MinHysteresis);
+
+	// too few samples of the surface to trust
+	if (channel.numSamples < CalibrationSamples / 2)
+		return;
+
+	// the limits move towards the surface, unless it is too close to the nominal limit
+#ifdef USE_DISTANCE_NOT_VOLTAGE
+	if (channel.mean + margin > nominalEdgeLimit)
+		return;
+	channel.edgeLimit = (unsigned)ceilf(channel.mean + margin);
+	channel.clearLimit = (unsigned)(channel.edgeLimit - hysteresis);
+#else
+	if (channel.mean - margin < nominalEdgeLimit)
+		return;
+	channel.edgeLimit = (unsigned)(channel.mean - margin);
+	channel.clearLimit = (unsigned)(channel.edgeLimit + hysteresis);
+#endif
+}
+
+void EdgeDetector::Handler()
+{
+	PROFILE_CALLBACK("EdgeDetector::Handler", Period);
+
+	DP::ADC812::Handler();
+
+	unsigned edge_mV[3];
+	edge_mV[LEFT] = GetSample_mV(LEFT);
+	edge_mV[FRONT] = GetSample_mV(FRONT);
+	edge_mV[RIGHT] = GetSample_mV(RIGHT);
+	flightRecorder.Edges(edge_mV);
+
+	// filter all three channels, then decide each one's edge with hysteresis
+	static const EDGE_SENSORS order[3] = {LEFT, FRONT, RIGHT};
+	unsigned filtered_mV[3];
+	unsigned edges = 0;
+	unsigned newEdges = 0;
+	for (int i = 0; i < 3; ++i)
+	{
+		Channel& channel = channels[order[i]];
+		filtered_mV[i] = Filter(channel, edge_mV[order[i]]);
+		if (numSamples < CalibrationSamples)
+			Calibrate(channel, edge_mV[order[i]]);
+	}
+	for (int i = 0; i < 3; ++i)
+	{
+		Channel& channel = channels[order[i]];
+		bool isAtEdge = channel.isAtEdge ?
+			!IsClearSample(order[i], filtered_mV[i]) : IsEdgeSample(order[i], filtered_mV[i]);
+		if (isAtEdge && !channel.isAtEdge)
+			newEdges |= (1u << i);
+		if (isAtEdge)
+			edges |= (1u << order[i]);
+		channel.isAtEdge = isAtEdge;
+	}
+	if (++numSamples == CalibrationSamples)
+	{
+		for (int i = 0; i < 3; ++i)
+			EndCalibration(channels[i]);
+	}
+	sensors.PublishEdges(edge_mV, edges);
+
+	// notify the edge handler of the first sensor to cross its limit in this sample
+	if (newEdges)
+	{
+		edgeLatency.EdgeSampled();
+		if (edgeHandler)
+		{
+			edgeHandler->OnEdge(order[__builtin_ctz(newEdges)]);
+		}
+	}
+	if (!edges)
+	{
+		edgeLatency.EdgeCleared();
+	}
+}
+
+void EdgeDetector::PrintCalibration(FILE* fp) const
+{
+	static const char* names[3] = {"left", "front", "right"};
+
+	for (int i = 0; i < 3; ++i)
+	{
+		fprintf(fp, "edge sensor %-5s: baseline %6.0f, noise %5.1f over %2u samples, limits %u/%u%s\n",
+			names[i], channels[i].mean, GetNoise((EDGE_SENSORS)i), channels[i].numSamples,
+			channels[i].edgeLimit, channels[i].clearLimit,
+			(channels[i].edgeLimit == nominalEdgeLimit) ? " (nominal)" : "");
+	}
+}
+
+bool EdgeDetector::AtAnyEdge(const SensorFrame& frame, enum EDGE_SENSORS* pEdge)
+{
+	static const EDGE_SENSORS order[3] = {LEFT, FRONT, RIGHT};
+
+	// no edge can be seen before the first sample
+	if (frame.edgeTime_us == 0)
+	{
+		return false;
+	}
+
+	for (int i = 0; i < 3; ++i)
+	{
+		if (frame.edges & (1u << order[i]))
+		{
+			if (pEdge)
+			{
+				*pEdge = order[i];
+			}
+			return true;
+		}
+	}
+
+	return false;
+}
+
 bool EdgeDetector::AtAnyEdge(enum EDGE_SENSORS* pEdge)
 {
 	if (AtEdge(LEFT))
@@ -280,3 +850,37 @@ bool EdgeDetector::AtAnyEdge(enum EDGE_SENSORS* pEdge)
 
 	return false;
 }
+
+void VoltMeter::Routine()
+{
+	PROFILE_CALLBACK("VoltMeter::Routine", Period);
+
+	ADC::Routine();
+
+	// estimate and publish the battery state only when it has been resampled
+	if (GetSampleCount(battChannel) != battSamples)
+	{
+		char modes[2] = {DP::DC2::BREAK, DP::DC2::BREAK};
+		float powers[2] = {0.0, 0.0};
+		for (int i = 0; locomotive && i < 2; ++i)
+		{
+			modes[i] = locomotive->GetMode(i);
+			powers[i] = locomotive->GetPower(i);
+		}
+		float load = battery.Current(modes, powers);
+
+		unsigned period = battery.GetSamplePeriod();
+		battSamples = GetSampleCount(battChannel);
+		battery.Update(MonotonicTime_us(), GetBatteryVoltage(), load);
+		sensors.PublishBattery(
+			GetBatteryVoltage(), battery.GetStateOfCharge(), battery.GetRuntime(), battery.GetLevel()
+		);
+		flightRecorder.Battery(GetBatteryVoltage());
+
+		// sample quicker as the battery runs down
+		if (battery.GetSamplePeriod() != period)
+		{
+			Subscribe(battChannel, battery.GetSamplePeriod());
+		}
+	}
+}
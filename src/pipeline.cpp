@@ -0,0 +1,244 @@
+/*
+ *  pipeline.cpp
+ *
+ *  Description: Implementation of the control pipeline
+ */
+
+#include <cerrno>
+#include <ctime>
+#include "clock.h"
+#include "profiler.h"
+#include "pipeline.h"
+
+static const char* EventNames[ControlPipeline::Event::NUM_TYPES] = {"odometry", "edge", "tick", "stop"};
+
+ControlPipeline::ControlPipeline(Locomotive& _locomotive) :
+	Callback(Controller::Period), locomotive(_locomotive), controller(0), isStopping(false), isThreaded(false),
+	numDeferred(0), numDropped(0), isOdometryPending(false), isEdgePending(false)
+{
+	sem_init(&pending, 0, 0);
+	sem_init(&finished, 0, 0);
+}
+
+ControlPipeline::~ControlPipeline()
+{
+	Stop();
+	sem_destroy(&finished);
+	sem_destroy(&pending);
+}
+
+void ControlPipeline::Start()
+{
+	if (IsThreaded())
+		return;
+
+	isStopping = false;
+	worker = std::thread(&ControlPipeline::Work, this);
+	isThreaded.store(true, std::memory_order_release);
+}
+
+bool ControlPipeline::Stop()
+{
+	struct timespec deadline;
+
+	if (!IsThreaded())
+		return true;
+
+	// the control thread runs whatever is queued before it sees the stop
+	isStopping = true;
+	sem_post(&pending);
+
+	// but it is not waited on for ever, it may be stuck
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += StopTimeout_ms / 1000;
+	deadline.tv_nsec += (StopTimeout_ms % 1000) * 1000000;
+	if (deadline.tv_nsec >= 1000000000)
+	{
+		deadline.tv_nsec -= 1000000000;
+		++deadline.tv_sec;
+	}
+	while (sem_timedwait(&finished, &deadline) < 0)
+	{
+		if (errno == ETIMEDOUT)
+		{
+			worker.detach();
+			return false;
+		}
+	}
+	worker.join();
+	isThreaded.store(false, std::memory_order_release);
+
+	// and whatever the full ring held back, here
+	if (isEdgePending)
+		Run(pendingEdge);
+	if (isOdometryPending)
+		Run(pendingOdometry);
+	isEdgePending = isOdometryPending = false;
+	return true;
+}
+
+bool ControlPipeline::Push(const Event& event)
+{
+	if (!events.Push(event))
+	{
+		++numDeferred;
+		return false;
+	}
+	sem_post(&pending);
+	return true;
+}
+
+void ControlPipeline::Post(const Event& event)
+{
+	if (!IsThreaded())
+	{
+		Run(event);
+		return;
+	}
+
+	// what the full ring held back goes first, the edge ahead of the odometry
+	if (isEdgePending && Push(pendingEdge))
+		isEdgePending = false;
+	if (isOdometryPending && !isEdgePending && Push(pendingOdometry))
+		isOdometryPending = false;
+
+	switch (event.type)
+	{
+		case Event::ODOMETRY:
+			// the counts are never lost, nor overtaken by later ones
+			if (isOdometryPending)
+			{
+				for (int i = 0; i < 2; ++i)
+				{
+					pendingOdometry.counts[i] += event.counts[i];
+					pendingOdometry.intervals[i] += event.intervals[i];
+				}
+			}
+			else if (isEdgePending || !Push(event))
+			{
+				pendingOdometry = event;
+				isOdometryPending = true;
+			}
+			break;
+		case Event::EDGE:
+			// the latest edge, as late as the first one held back
+			if (isEdgePending)
+			{
+				pendingEdge.edge = event.edge;
+			}
+			else if (!Push(event))
+			{
+				pendingEdge = event;
+				isEdgePending = true;
+			}
+			break;
+		case Event::STOP:
+			// the control thread is that far behind: rather than wait its turn in the ring,
+			// the stop is made at its next motor command or event, whichever comes first,
+			// so the DC2 keeps its one writer
+			if (!Push(event))
+			{
+				locomotive.RequestHalt();
+				sem_post(&pending);
+			}
+			break;
+		default:
+			if (!Push(event))
+				++numDropped;
+			break;
+	}
+}
+
+void ControlPipeline::Run(const Event& event)
+{
+	// event driven, so it has no period
+	PROFILE_CALLBACK("ControlPipeline::Run", 0);
+
+	switch (event.type)
+	{
+		case Event::ODOMETRY:
+			locomotive.Update(event.counts, event.intervals);
+			break;
+		case Event::EDGE:
+			if (controller)
+				controller->OnEdge((EdgeDetector::EDGE_SENSORS)event.edge);
+			break;
+		case Event::TICK:
+			if (controller)
+				controller->Routine();
+			break;
+		case Event::STOP:
+			locomotive.EmergencyStop();
+			break;
+		default:
+			break;
+	}
+	latencies[event.type].Record((Profiler::Now_ns() - event.arrival_ns) / 1000);
+}
+
+void ControlPipeline::Work()
+{
+	for (;;)
+	{
+		while (sem_wait(&pending) < 0)
+			;
+
+		// a halt requested while the ring was full goes ahead of the events
+		locomotive.CheckHalt();
+
+		// one post per event plus one for the stop, so the queue drains first; a halt
+		// request adds one more
+		Event event;
+		if (events.Pop(&event))
+			Run(event);
+		else if (isStopping)
+			break;
+	}
+	sem_post(&finished);
+}
+
+void ControlPipeline::Odometry(const unsigned counts[2], const float intervals[2])
+{
+	Event event = {Event::ODOMETRY, PacketArrival_ns(), 0, {counts[0], counts[1]}, {intervals[0], intervals[1]}};
+	Post(event);
+}
+
+void ControlPipeline::OnEdge(enum EdgeDetector::EDGE_SENSORS edge)
+{
+	Event event = {Event::EDGE, PacketArrival_ns(), (unsigned)edge, {0, 0}, {0.0, 0.0}};
+	Post(event);
+}
+
+void ControlPipeline::Routine()
+{
+	PROFILE_CALLBACK("ControlPipeline::Routine", Controller::Period);
+
+	Event event = {Event::TICK, PacketArrival_ns(), 0, {0, 0}, {0.0, 0.0}};
+	Post(event);
+}
+
+void ControlPipeline::EmergencyStop()
+{
+	if (!IsThreaded() || IsControlThread())
+	{
+		locomotive.EmergencyStop();
+		return;
+	}
+
+	Event event = {Event::STOP, PacketArrival_ns(), 0, {0, 0}, {0.0, 0.0}};
+	Post(event);
+}
+
+void ControlPipeline::Print(FILE* fp) const
+{
+	char name[64];
+
+	for (unsigned i = 0; i < Event::NUM_TYPES; ++i)
+	{
+		snprintf(name, sizeof(name), "sensor to actuator, %s", EventNames[i]);
+		latencies[i].Print(fp, name);
+	}
+	if (numDeferred)
+		fprintf(fp, "sensor to actuator: %lu events held back and %lu ticks dropped, the control thread fell behind\n",
+			numDeferred, numDropped);
+}
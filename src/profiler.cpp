@@ -0,0 +1,87 @@
+/*
+ *  profiler.cpp
+ *
+ *  Description: Implementation of the event loop profiler
+ */
+
+#include <time.h>
+#include "clock.h"
+#include "profiler.h"
+
+Profiler profiler;
+
+ProfileSlot::ProfileSlot(const char* _name, unsigned _period) :
+	name(_name), period(_period), lastStart_us(0), overruns(0), missedDeadlines(0)
+{
+	profiler.Add(this);
+}
+
+void ProfileSlot::Started(uint64_t start_us)
+{
+	if (lastStart_us != 0 && period != 0)
+	{
+		uint64_t interval_us = start_us - lastStart_us;
+		uint64_t period_us = (uint64_t)period * 1000;
+
+		// an early start, e.g. an event driven run, is not jitter of the periodic one
+		if (interval_us >= period_us)
+		{
+			jitters.Record(interval_us - period_us);
+			if (interval_us - period_us > period_us / 2)
+				++missedDeadlines;
+		}
+	}
+	lastStart_us = start_us;
+}
+
+void ProfileSlot::Finished(uint64_t execTime_ns)
+{
+	execTimes.Record(execTime_ns);
+	if (period != 0 && execTime_ns > (uint64_t)period * 1000000)
+		++overruns;
+}
+
+Profiler::Profiler() : isEnabled(false), numSlots(0)
+{
+}
+
+void Profiler::Add(ProfileSlot* slot)
+{
+	unsigned n = numSlots.fetch_add(1, std::memory_order_relaxed);
+
+	if (n < MaxSlots)
+		slots[n] = slot;
+}
+
+uint64_t Profiler::Now_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void Profiler::Print(FILE* fp) const
+{
+	fprintf(fp, "%-24s %6s %8s | %9s %9s %9s %9s | %9s %9s | %8s %6s\n",
+		"callback", "period", "calls", "min uS", "mean uS", "p99 uS", "max uS",
+		"jit mS", "jit max mS", "overruns", "missed");
+	unsigned n = (numSlots < MaxSlots) ? (unsigned)numSlots : MaxSlots;
+	for (unsigned i = 0; i < n; ++i)
+	{
+		const ProfileSlot* s = slots[i];
+		fprintf(fp, "%-24s %6u %8lu | %9.1f %9.1f %9.1f %9.1f | %9.1f %9.1f | %8lu %6lu\n",
+			s->name, s->period, s->execTimes.Count(),
+			s->execTimes.Min() / 1e3, s->execTimes.Mean() / 1e3,
+			s->execTimes.Percentile(0.99) / 1e3, s->execTimes.Max() / 1e3,
+			s->jitters.Mean() / 1e3, s->jitters.Max() / 1e3,
+			s->overruns, s->missedDeadlines);
+	}
+}
+
+void ProfileScope::Start(ProfileSlot& _slot)
+{
+	slot = &_slot;
+	slot->Started(MonotonicTime_us());
+	start_ns = Profiler::Now_ns();
+}
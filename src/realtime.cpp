@@ -0,0 +1,140 @@
+/*
+ *  realtime.cpp
+ *
+ *  Description: Implementation of the real-time scheduling setup and jitter probe
+ */
+
+#include <cstring>
+#include <cerrno>
+#include <malloc.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "realtime.h"
+
+// the first CPU in the kernel's isolated list, -1 if none is isolated
+static int IsolatedCPU()
+{
+	FILE* fp = fopen("/sys/devices/system/cpu/isolated", "r");
+	int cpu = -1;
+
+	if (fp)
+	{
+		if (fscanf(fp, "%d", &cpu) != 1)
+			cpu = -1;
+		fclose(fp);
+	}
+	return cpu;
+}
+
+// touch the stack the loop may grow into while it is locked, so it never faults later
+static void __attribute__((noinline)) PrefaultStack()
+{
+	volatile unsigned char stack[StackPrefault];
+
+	for (unsigned i = 0; i < StackPrefault; i += 4096)
+		stack[i] = 0;
+	(void)stack;
+}
+
+unsigned EnterRealtime(FILE* fp)
+{
+	unsigned numTaken = 0;
+
+	// 1. memory, and the heap is neither trimmed nor served from fresh mappings
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) == 0)
+	{
+		mallopt(M_TRIM_THRESHOLD, -1);
+		mallopt(M_MMAP_MAX, 0);
+		fprintf(fp, "realtime: memory locked\n");
+		++numTaken;
+	}
+	else
+	{
+		fprintf(fp, "realtime: WARNING: cannot lock memory (%s), it may be paged\n", strerror(errno));
+	}
+
+	// 2. stack
+	PrefaultStack();
+	fprintf(fp, "realtime: %u kB of stack pre-faulted\n", StackPrefault / 1024);
+	++numTaken;
+
+	// 3. CPU
+	int numCPUs = sysconf(_SC_NPROCESSORS_ONLN);
+	int cpu = IsolatedCPU();
+	bool isIsolated = (cpu >= 0);
+	if (!isIsolated)
+		cpu = numCPUs - 1;
+	if (numCPUs > 1 || isIsolated)
+	{
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(cpu, &cpus);
+		if (sched_setaffinity(0, sizeof(cpus), &cpus) == 0)
+		{
+			fprintf(fp, "realtime: pinned to CPU %d%s\n", cpu, isIsolated ? ", isolated" : ", not isolated, see isolcpus=");
+			++numTaken;
+		}
+		else
+		{
+			fprintf(fp, "realtime: WARNING: cannot pin to CPU %d (%s)\n", cpu, strerror(errno));
+		}
+	}
+	else
+	{
+		fprintf(fp, "realtime: WARNING: a single CPU, not pinned\n");
+	}
+
+	// 4. scheduling policy
+	struct sched_param param;
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = FifoPriority;
+	if (sched_setscheduler(0, SCHED_FIFO, &param) == 0)
+	{
+		fprintf(fp, "realtime: SCHED_FIFO at priority %d\n", FifoPriority);
+		++numTaken;
+	}
+	else
+	{
+		fprintf(fp, "realtime: WARNING: cannot use SCHED_FIFO (%s), staying under the normal scheduler\n", strerror(errno));
+	}
+
+	return numTaken;
+}
+
+JitterProbe::JitterProbe(unsigned _period) :
+	period(_period), lastTick_us(0), minInterval_us(UINT64_MAX), maxInterval_us(0), earlyTicks(0)
+{
+}
+
+void JitterProbe::Tick(uint64_t now_us)
+{
+	if (lastTick_us != 0)
+	{
+		uint64_t interval_us = now_us - lastTick_us;
+		uint64_t period_us = (uint64_t)period * 1000;
+
+		if (interval_us < minInterval_us)
+			minInterval_us = interval_us;
+		if (interval_us > maxInterval_us)
+			maxInterval_us = interval_us;
+		if (interval_us >= period_us)
+			lateness.Record(interval_us - period_us);
+		else
+			++earlyTicks;
+	}
+	lastTick_us = now_us;
+}
+
+void JitterProbe::Print(FILE* fp, const char* name) const
+{
+	unsigned long count = lateness.Count() + earlyTicks;
+
+	if (count == 0)
+		return;
+	fprintf(fp, "jitter: %s, %u mS nominal, %lu periods: achieved %.3f..%.3f mS, "
+		"late by p50 %llu, p99 %llu, max %llu uS, %lu early\n",
+		name, period, count, minInterval_us / 1e3, maxInterval_us / 1e3,
+		(unsigned long long)lateness.Percentile(0.5), (unsigned long long)lateness.Percentile(0.99),
+		(unsigned long long)lateness.Max(), earlyTicks);
+}
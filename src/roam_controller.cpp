@@ -5,106 +5,103 @@
  *  will traverse a table without falling off.  The algorithm is as follows:
  *      1. Move forward until an edge or an object is detected then stop.
  *      2. Backup 3cm.
- *      3. If the left edge was detected, a request is made to turn .8 radians clockwise.  If
- *         the right edge was detected, a request is made to turn .8 radians counter clockwise.
- *         If the front edge was detected, a request is made to turn 1.6 radians counter clockwise.
- *      4. Make the requested turn from state 3, then move forward and return to step 1.
+ *      3. If the left edge was detected, turn .8 radians clockwise.  If the right edge was
+ *         detected, turn .8 radians counter clockwise.  If the front edge was detected, turn
+ *         1.6 radians counter clockwise.  An object seen by a range sensor off to one side
+ *         counts as an edge on that side.
+ *      4. Move forward and return to step 1.
  *
- *  The controller is implemented as a state machine with 4 states corresponding
- *  to the steps of the algorithm described above.  There is no completion state; roaming
- *  will continue until the right-most button on jefebot is pressed.
+ *  Steps 2 to 4 are submitted to the locomotive as one motion sequence that runs without
+ *  stopping between its segments, so the controller is a state machine with just 2 states:
+ *  ROAM, step 1, and AVOID_EDGE, which submits the sequence on entry and is left when the
+ *  sequence completes.  There is no completion state; roaming will continue until the
+ *  right-most button on jefebot is pressed.  The states are declared in the table in
+ *  roam_controller.h.
  *
- *  The Routine() function is registered in the main program as a periodic event handler, and
- *  is therefore continually called at a rate specified during its registration.
+ *  Routine() runs every Period mS, and at once on a new edge through OnEdge(), each time
+ *  reading a sensor frame and ticking the state machine; see pipeline.h for the thread it
+ *  runs on.  OnMotionComplete() is called by the locomotive when the avoidance sequence
+ *  is done, and returns the machine to ROAM.
  */
 
 #include "roam_controller.h"
+#include "latency.h"
+#include "profiler.h"
+
+constexpr RoamController::Row RoamController::States[];
 
 RoamController::RoamController(Context& ctx, bool isVerbose) :
-	Controller(ctx, isVerbose), state(ROAM)
+	Controller(ctx, isVerbose), objectAngle(0.0), machine(*this, ControllerTracer(FR_ROAM, isVerbose))
 
 {
-	if (isVerbose) printf("changing state to ROAM\n");
+	machine.Start(ROAM);
 	ui.Display(0x01);
 	locomotive.MoveForward();
 }
 
 void RoamController::Routine()
 {
-	switch (state)
+	PROFILE_CALLBACK("RoamController", Period);
+
+	ReadSensors();
+	machine.Tick();
+}
+
+void RoamController::Roam()
+{
+	if (edgeDetector.AtAnyEdge(frame, &edge))
 	{
-		case ROAM:
-			if (edgeDetector.AtAnyEdge(&edge))
-			{
-				if (isVerbose)
-				{
-					printf("edge %d found:\n", edge);
-					printf("  left sensor value = %d\n", edgeDetector.GetEdgeSensorValue(EdgeDetector::LEFT));
-					printf("  front sensor value = %d\n", edgeDetector.GetEdgeSensorValue(EdgeDetector::FRONT));
-					printf("  right sensor value = %d\n", edgeDetector.GetEdgeSensorValue(EdgeDetector::RIGHT));
-				}
-				if (isVerbose) printf("changing state to BACKUP\n");
-				locomotive.Stop();
-				distanceToMove = 3;
-				locomotive.MoveReverse();
-				state = BACKUP;
-			}
-			else if (rangeSensor.AtObject())
-			{
-				edge = EdgeDetector::FRONT;
-				locomotive.Stop();
-				distanceToMove = 3;
-				locomotive.MoveReverse();
-				if (isVerbose) printf("changing state to BACKUP\n");
-				state = BACKUP;
-			}
-			break;
+		edgeLatency.EdgeDecided();
+		if (isVerbose)
+		{
+			logger.Print("edge %d found:\n", edge);
+			logger.Print("  left sensor value = %d\n", frame.edge_mV[EdgeDetector::LEFT]);
+			logger.Print("  front sensor value = %d\n", frame.edge_mV[EdgeDetector::FRONT]);
+			logger.Print("  right sensor value = %d\n", frame.edge_mV[EdgeDetector::RIGHT]);
+		}
+		locomotive.Stop();
+		machine.ChangeState(AVOID_EDGE);
+	}
+	else if (rangeSensor.AtAnyObject(frame, &objectAngle))
+	{
+		// turn away from an object off to one side as from an edge on that side
+		if (objectAngle > ObjectSideAngle)
+			edge = EdgeDetector::LEFT;
+		else if (objectAngle < -ObjectSideAngle)
+			edge = EdgeDetector::RIGHT;
+		else
+			edge = EdgeDetector::FRONT;
+		locomotive.Stop();
+		machine.ChangeState(AVOID_EDGE);
+	}
+}
 
-		case BACKUP:
-			if (locomotive.HasMovedDistance(distanceToMove))
-			{
-				if (isVerbose) printf("changing state to AVOID_EDGE\n");
-				state = AVOID_EDGE;
-			}
-			break;
+void RoamController::AvoidEdge()
+{
+	Locomotive::MotionSegment segments[3] =
+	{
+		{Locomotive::MOTION_REVERSE, 3.0},
+		{Locomotive::MOTION_SPIN_CCW, 1.6},
+		{Locomotive::MOTION_FORWARD, 0.0}
+	};
 
-		case AVOID_EDGE:
-			locomotive.Stop();
-			switch (edge)
-			{
-				case EdgeDetector::LEFT:
-					angleToTurn = 0.8;
-					locomotive.SpinCW();
-					break;
-				case EdgeDetector::RIGHT:
-					angleToTurn = 0.8;
-					locomotive.SpinCCW();
-					break;
-				case EdgeDetector::FRONT:
-					angleToTurn = 1.6;
-					locomotive.SpinCCW();
-					break;
-				default:
-					angleToTurn = 1.6;
-					locomotive.SpinCCW();
-					break;
-			}
-			if (isVerbose) printf("changing state to TURN\n");
-			state = TURN;
+	// back up then turn away from the edge
+	switch (edge)
+	{
+		case EdgeDetector::LEFT:
+			segments[1].motion = Locomotive::MOTION_SPIN_CW;
+			segments[1].amount = 0.8;
 			break;
-
-		case TURN:
-			if (locomotive.HasTurnedAngle(angleToTurn))
-			{
-				locomotive.Stop();
-				locomotive.MoveForward();
-				if (isVerbose) printf("changing state to ROAM\n");
-				state = ROAM;
-			}
+		case EdgeDetector::RIGHT:
+			segments[1].amount = 0.8;
 			break;
-
-
 		default:
-			assert(false);
+			break;
 	}
+	locomotive.Submit(segments, 3, this);
+}
+
+void RoamController::OnMotionComplete()
+{
+	machine.ChangeState(ROAM);
 }
@@ -0,0 +1,119 @@
+/*
+ *  sensor_frame.cpp
+ *
+ *  Description: Implementation of the SensorFrameBuffer class
+ */
+
+#include <cstring>
+#include "clock.h"
+#include "sensor_frame.h"
+
+SensorFrameBuffer::SensorFrameBuffer() : latest(0)
+{
+	writerLock.clear();
+	memset(&pending, 0, sizeof(pending));
+	for (int i = 0; i < 2; ++i)
+	{
+		slots[i].sequence.store(0, std::memory_order_relaxed);
+		slots[i].frame = pending;
+	}
+}
+
+void SensorFrameBuffer::Publish()
+{
+	unsigned index = latest.load(std::memory_order_relaxed) ^ 1;
+	Slot& slot = slots[index];
+	unsigned seq = slot.sequence.load(std::memory_order_relaxed);
+
+	++pending.sequence;
+
+	// mark the slot busy, fill it, mark it stable, then point readers at it
+	slot.sequence.store(seq + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	slot.frame = pending;
+	slot.sequence.store(seq + 2, std::memory_order_release);
+	latest.store(index, std::memory_order_release);
+}
+
+void SensorFrameBuffer::PublishEdges(const unsigned edge_mV[3], unsigned edges)
+{
+	uint64_t now_us = MonotonicTime_us();
+
+	Lock();
+	pending.edgeTime_us = now_us;
+	for (int i = 0; i < 3; ++i)
+		pending.edge_mV[i] = edge_mV[i];
+	pending.edges = edges;
+	Publish();
+	Unlock();
+}
+
+// only the sensors in the mask were read
+void SensorFrameBuffer::PublishRanges(unsigned mask, const unsigned distances[4])
+{
+	uint64_t now_us = MonotonicTime_us();
+
+	Lock();
+	for (int i = 0; i < 4; ++i)
+	{
+		if (mask & (1u << i))
+		{
+			pending.rangeTimes_us[i] = now_us;
+			pending.ranges[i] = distances[i];
+		}
+	}
+	if (mask & 1)
+	{
+		pending.rangeTime_us = now_us;
+		pending.distance = distances[0];
+	}
+	Publish();
+	Unlock();
+}
+
+void SensorFrameBuffer::PublishOdometry(const int ticks[2], const unsigned counts[2], const float intervals[2], const Pose& pose)
+{
+	uint64_t now_us = MonotonicTime_us();
+
+	Lock();
+	pending.odometryTime_us = now_us;
+	for (int i = 0; i < 2; ++i)
+	{
+		pending.ticks[i] = ticks[i];
+		pending.counts[i] = counts[i];
+		pending.intervals[i] = intervals[i];
+	}
+	pending.pose = pose;
+	Publish();
+	Unlock();
+}
+
+void SensorFrameBuffer::PublishBattery(float voltage, float stateOfCharge, float runtime, unsigned level)
+{
+	uint64_t now_us = MonotonicTime_us();
+
+	Lock();
+	pending.batteryTime_us = now_us;
+	pending.batteryVoltage = voltage;
+	pending.stateOfCharge = stateOfCharge;
+	pending.batteryRuntime = runtime;
+	pending.batteryLevel = level;
+	Publish();
+	Unlock();
+}
+
+void SensorFrameBuffer::Read(SensorFrame* frame) const
+{
+	for (;;)
+	{
+		const Slot& slot = slots[latest.load(std::memory_order_acquire)];
+		unsigned seq = slot.sequence.load(std::memory_order_acquire);
+
+		if (seq & 1)
+			continue;
+		*frame = slot.frame;
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (slot.sequence.load(std::memory_order_relaxed) == seq)
+			return;
+	}
+}
@@ -0,0 +1,166 @@
+/*
+ *  sound.cpp
+ *
+ *  Description: Implementation of the sound player and its sinks
+ */
+
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <string>
+#include <pthread.h>
+#include <dp_events.h>
+#include "sound.h"
+
+SoundPlayer soundPlayer;
+
+static const char* SoundNames[SoundPlayer::NUM_SOUNDS] = {"wawa", "woohoo"};
+
+FileSoundSink::FileSoundSink(const char* path)
+{
+	if ((fp = fopen(path, "ab")) == 0)
+	{
+		throw DP::FrameworkException("FileSoundSink", ERR_INITIALIZATION);
+	}
+}
+
+FileSoundSink::~FileSoundSink()
+{
+	fclose(fp);
+}
+
+void FileSoundSink::Play(const char* name, const std::vector<uint8_t>& wav)
+{
+	fwrite(wav.data(), 1, wav.size(), fp);
+	fflush(fp);
+}
+
+void PipeSoundSink::Play(const char* name, const std::vector<uint8_t>& wav)
+{
+	FILE* fp;
+
+	// the player reads the WAV from stdin and exits at its end, the clip is over by then
+	if ((fp = popen(command, "w")) == 0)
+	{
+		fprintf(stderr, "sound: %s: %s\n", command, strerror(errno));
+		return;
+	}
+
+	// a player that is missing or exits early fails the write with EPIPE, see Work()
+	size_t length = fwrite(wav.data(), 1, wav.size(), fp);
+	int error = errno;
+	int status = pclose(fp);
+	if (length != wav.size())
+		fprintf(stderr, "sound: %s could not play %s: %s\n", command, name, strerror(error));
+	else if (status != 0)
+		fprintf(stderr, "sound: %s could not play %s: exit status %#x\n", command, name, status);
+}
+
+SoundPlayer::SoundPlayer() : sink(0), isStopping(false)
+{
+	sem_init(&pending, 0, 0);
+}
+
+SoundPlayer::~SoundPlayer()
+{
+	Stop();
+	sem_destroy(&pending);
+}
+
+const char* SoundPlayer::Name(SOUND sound)
+{
+	return SoundNames[sound];
+}
+
+unsigned SoundPlayer::Load(const char* dir)
+{
+	unsigned numLoaded = 0;
+
+	for (unsigned i = 0; i < NUM_SOUNDS; ++i)
+	{
+		std::string path = std::string(dir) + "/" + SoundNames[i] + ".wav";
+		FILE* fp = fopen(path.c_str(), "rb");
+		std::vector<uint8_t>& wav = sounds[i];
+
+		wav.clear();
+		if (!fp)
+			continue;
+
+		uint8_t buf[4096];
+		size_t n;
+		while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+			wav.insert(wav.end(), buf, buf + n);
+		fclose(fp);
+
+		// only keep what a player can play
+		if (wav.size() < 44 || memcmp(wav.data(), "RIFF", 4) != 0 || memcmp(wav.data() + 8, "WAVE", 4) != 0)
+		{
+			wav.clear();
+			continue;
+		}
+		++numLoaded;
+	}
+
+	return numLoaded;
+}
+
+void SoundPlayer::Start(SoundSink* _sink)
+{
+	if (IsStarted() || !_sink)
+	{
+		throw DP::FrameworkException("SoundPlayer", ERR_PARAMS);
+	}
+
+	sink = _sink;
+	isStopping = false;
+	worker = std::thread(&SoundPlayer::Work, this);
+}
+
+void SoundPlayer::Stop()
+{
+	if (!IsStarted())
+		return;
+
+	// the worker plays whatever is queued before it sees the stop
+	isStopping = true;
+	sem_post(&pending);
+	worker.join();
+	sink = 0;
+}
+
+bool SoundPlayer::Play(SOUND sound)
+{
+	if (!IsStarted() || sounds[sound].empty() || !queue.Push(sound))
+		return false;
+
+	sem_post(&pending);
+	return true;
+}
+
+void SoundPlayer::Work()
+{
+	sigset_t sigpipe;
+
+	// a sink writing to a player that has gone gets EPIPE rather than a SIGPIPE, which would
+	// kill jefebot with the motors running
+	sigemptyset(&sigpipe);
+	sigaddset(&sigpipe, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &sigpipe, 0);
+
+	for (;;)
+	{
+		while (sem_wait(&pending) < 0)
+			;
+
+		// one post per request plus one for the stop, so the queue drains first
+		SOUND sound;
+		if (queue.Pop(&sound))
+		{
+			sink->Play(SoundNames[sound], sounds[sound]);
+		}
+		else if (isStopping)
+		{
+			break;
+		}
+	}
+}
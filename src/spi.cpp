@@ -0,0 +1,56 @@
+/*
+ *  spi.cpp
+ *
+ *  Description: Implementation of the spidev transport used by the ADC class
+ */
+
+#include <sys/fcntl.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include "spi.h"
+
+// SPIOpen():  Open/init an SPI device.  Return fd or -1
+int SPIOpen(const char *dev, uint8_t mode, uint8_t bits, uint32_t speed)
+{
+    int fd;
+
+    fd = open(dev, O_RDWR);
+    if (fd < 0)
+        return(-1);
+
+    /* spi mode */
+    if ((ioctl(fd, SPI_IOC_WR_MODE, &mode) == -1) ||
+        (ioctl(fd, SPI_IOC_RD_MODE, &mode) == -1))
+    {
+        close(fd);
+        return(-1);
+    }
+
+    /* bits per word */
+    if ((ioctl(fd, SPI_IOC_WR_BITS_PER_WORD, &bits) == -1) ||
+        (ioctl(fd, SPI_IOC_RD_BITS_PER_WORD, &bits) == -1))
+    {
+        close(fd);
+        return(-1);
+    }
+
+    /* max speed hz */
+    if ((ioctl(fd, SPI_IOC_WR_MAX_SPEED_HZ, &speed) == -1) ||
+        (ioctl(fd, SPI_IOC_RD_MAX_SPEED_HZ, &speed) == -1))
+    {
+        close(fd);
+        return(-1);
+    }
+
+    return(fd);
+}
+
+// SPITransfer():  Perform count full duplex transfers in one ioctl.  Return -1 on error
+int SPITransfer(int fd, struct spi_ioc_transfer *tr, unsigned count)
+{
+    // SPI_IOC_MESSAGE() needs a constant count so build the request code directly
+    if (count == 0 || SPI_MSGSIZE(count) == 0)
+        return(-1);
+
+    return ioctl(fd, _IOC(_IOC_WRITE, SPI_IOC_MAGIC, 0, SPI_MSGSIZE(count)), tr);
+}
@@ -0,0 +1,170 @@
+/*
+ *  telemetry.cpp
+ *
+ *  Description: Implementation of the telemetry publisher
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dp_events.h>
+#include "clock.h"
+#include "telemetry.h"
+
+Telemetry telemetry;
+
+Telemetry::Telemetry() : fd(-1), numSubscribers(0), numSent(0), numMissed(0)
+{
+	path[0] = '\0';
+	memset((void*)&packet, 0, sizeof(packet));
+	memcpy(packet.magic, "JTLM", 4);
+	packet.version = TelemetryPacket::Version;
+	packet.size = sizeof(TelemetryPacket);
+	packet.controller.store(-1, std::memory_order_relaxed);
+}
+
+Telemetry::~Telemetry()
+{
+	Close();
+}
+
+void Telemetry::Open(const char* _path)
+{
+	struct sockaddr_un addr;
+
+	if (IsOpen() || strlen(_path) >= sizeof(addr.sun_path))
+	{
+		throw DP::FrameworkException("Telemetry", ERR_PARAMS);
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, _path);
+
+	// a socket left by a run that did not shut down would keep the bind from succeeding
+	unlink(_path);
+	if ((fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0)
+	{
+		throw DP::FrameworkException("Telemetry", ERR_INITIALIZATION);
+	}
+	if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+	{
+		close(fd);
+		fd = -1;
+		throw DP::FrameworkException("Telemetry", ERR_INITIALIZATION);
+	}
+	strcpy(path, _path);
+}
+
+void Telemetry::Close()
+{
+	if (!IsOpen())
+		return;
+
+	close(fd);
+	unlink(path);
+	fd = -1;
+	numSubscribers = 0;
+}
+
+void Telemetry::Subscribe(const struct sockaddr_un& addr, socklen_t addrLength, bool isSubscribing, uint64_t now_us)
+{
+	unsigned i;
+
+	for (i = 0; i < numSubscribers; ++i)
+	{
+		if (subscribers[i].addrLength == addrLength && memcmp(&subscribers[i].addr, &addr, addrLength) == 0)
+			break;
+	}
+
+	if (!isSubscribing)
+	{
+		if (i < numSubscribers)
+			Unsubscribe(i);
+		return;
+	}
+
+	// a new subscriber beyond the limit is ignored, it keeps asking
+	if (i == numSubscribers)
+	{
+		if (numSubscribers == MaxSubscribers)
+			return;
+		subscribers[i].addr = addr;
+		subscribers[i].addrLength = addrLength;
+		++numSubscribers;
+	}
+	subscribers[i].lastRequest_us = now_us;
+}
+
+void Telemetry::Unsubscribe(unsigned index)
+{
+	subscribers[index] = subscribers[--numSubscribers];
+}
+
+void Telemetry::Publish(const SensorFrameBuffer& sensors)
+{
+	TelemetryRequest request;
+	struct sockaddr_un addr;
+	socklen_t addrLength;
+	ssize_t length;
+	uint64_t now_us;
+
+	if (!IsOpen())
+		return;
+
+	// take the requests that came in since the last time
+	now_us = MonotonicTime_us();
+	for (;;)
+	{
+		addrLength = sizeof(addr);
+		length = recvfrom(fd, &request, sizeof(request), 0, (struct sockaddr*)&addr, &addrLength);
+		if (length < 0)
+			break;
+		if (
+			length == sizeof(request) && memcmp(request.magic, "JTLR", 4) == 0 &&
+			request.version == TelemetryPacket::Version && addrLength > sizeof(sa_family_t)
+		)
+			Subscribe(addr, addrLength, request.isSubscribing, now_us);
+	}
+
+	for (unsigned i = 0; i < numSubscribers; )
+	{
+		if (now_us - subscribers[i].lastRequest_us > SubscriptionTimeout_us)
+			Unsubscribe(i);
+		else
+			++i;
+	}
+	if (numSubscribers == 0)
+		return;
+
+	// the sensor frame goes straight into the packet, the rest is already there
+	sensors.Read(&packet.frame);
+	++packet.sequence;
+	packet.time_us = MonotonicTime_us();
+
+	for (unsigned i = 0; i < numSubscribers; )
+	{
+		if (sendto(fd, &packet, sizeof(packet), 0, (struct sockaddr*)&subscribers[i].addr, subscribers[i].addrLength) == sizeof(packet))
+		{
+			++numSent;
+		}
+		else if (errno == EAGAIN || errno == ENOBUFS)
+		{
+			++numMissed;
+		}
+		else
+		{
+			// the subscriber has gone without saying so
+			Unsubscribe(i);
+			continue;
+		}
+		++i;
+	}
+}
+
+void Telemetry::Print(FILE* fp) const
+{
+	if (numSent || numMissed)
+		fprintf(fp, "telemetry: %lu packets sent, %lu missed by slow subscribers\n", numSent, numMissed);
+}
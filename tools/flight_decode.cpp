@@ -0,0 +1,134 @@
+/*
+ *  flight_decode.cpp
+ *
+ *  Description: Dump a flight recorder ring file as CSV, oldest record first.  Times are
+ *  in seconds from the start of the recording and values are converted back to their
+ *  natural units.
+ *
+ *  Synopsis:
+ *      flight_decode <file> [seconds]
+ *
+ *      seconds:    only dump the last seconds of the recording
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "flight_recorder.h"
+
+static const char* TypeNames[FR_NUM_TYPES] =
+{
+	"none", "edges", "range", "odometry", "battery", "motor_mode", "motor_power", "speed_error", "state",
+	"shutdown"
+};
+
+static void PrintRecord(const FlightRecord& r, uint64_t startTime_us)
+{
+	const int32_t* v = r.values;
+	float interval;
+
+	printf("%.6f,%s,%u,", (r.time_us - startTime_us) / 1e6, TypeNames[r.type], r.source);
+	switch (r.type)
+	{
+		case FR_EDGES:
+			printf("%d,%d,%d\n", v[0], v[1], v[2]);
+			break;
+		case FR_RANGE:
+			printf("%d,,\n", v[0]);
+			break;
+		case FR_ODOMETRY:
+			memcpy(&interval, &v[1], sizeof(interval));
+			printf("%d,%.6f,%d\n", v[0], interval, v[2]);
+			break;
+		case FR_BATTERY:
+			printf("%.3f,,\n", v[0] / 1e3);
+			break;
+		case FR_MOTOR_MODE:
+			printf("%c,%c,\n", v[0], v[1]);
+			break;
+		case FR_MOTOR_POWER:
+			printf("%.2f,%.2f,\n", v[0] / 1e2, v[1] / 1e2);
+			break;
+		case FR_SPEED_ERROR:
+			printf("%.3f,%.2f,\n", v[0] / 1e3, v[1] / 1e2);
+			break;
+		case FR_SHUTDOWN:
+			printf("%d,,\n", v[0]);
+			break;
+		default:
+			printf("%d,%d,%d\n", v[0], v[1], v[2]);
+			break;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	int fd;
+	struct stat st;
+	void* map;
+	double window = -1.0;
+
+	if (argc < 2 || argc > 3)
+	{
+		fprintf(stderr, "usage: flight_decode <file> [seconds]\n");
+		return EXIT_FAILURE;
+	}
+	if (argc == 3)
+	{
+		window = atof(argv[2]);
+	}
+
+	if ((fd = open(argv[1], O_RDONLY)) < 0 || fstat(fd, &st) < 0)
+	{
+		perror(argv[1]);
+		return EXIT_FAILURE;
+	}
+	if ((size_t)st.st_size < sizeof(FlightRecorderHeader))
+	{
+		fprintf(stderr, "%s: not a flight recorder file\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+	map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+	{
+		perror(argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	const FlightRecorderHeader* header = (const FlightRecorderHeader*)map;
+	const FlightRecord* records = (const FlightRecord*)(header + 1);
+	if (!header->IsValid(st.st_size))
+	{
+		fprintf(stderr, "%s: not a version %u flight recorder file\n", argv[1], FlightRecorderHeader::Version);
+		return EXIT_FAILURE;
+	}
+
+	// the ring holds the last capacity records
+	uint64_t head = header->head.load(std::memory_order_acquire);
+	uint64_t capacity = header->capacity;
+	uint64_t first = (head > capacity) ? head - capacity : 0;
+
+	// skip to the start of the requested window, measured back from the last record
+	if (window >= 0.0 && head > first)
+	{
+		uint64_t endTime_us = records[(head - 1) % capacity].time_us;
+		while (first < head && records[first % capacity].time_us + window * 1e6 < endTime_us)
+			++first;
+	}
+
+	printf("time,type,source,a,b,c\n");
+	for (uint64_t n = first; n < head; ++n)
+	{
+		const FlightRecord& r = records[n % capacity];
+		if (r.type != FR_NONE && r.type < FR_NUM_TYPES)
+			PrintRecord(r, header->startTime_us);
+	}
+
+	munmap(map, st.st_size);
+	return EXIT_SUCCESS;
+}
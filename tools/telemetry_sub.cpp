@@ -0,0 +1,156 @@
+/*
+ *  telemetry_sub.cpp
+ *
+ *  Description: Subscribe to a running jefebot's telemetry and print each packet as a
+ *  line of CSV, until interrupted or the given number of packets has come.  Times are in
+ *  seconds from the first packet.  The subscription is renewed every second, and given
+ *  up on exit; a packet missed, because this fell behind or the publisher could not
+ *  send it, is counted from the gaps in the packet numbers and reported on exit.
+ *
+ *  Synopsis:
+ *      telemetry_sub <socket> [packets]
+ *
+ *      socket:     the path jefebot was given with -l
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include "telemetry.h"
+
+static const int RenewPeriod_ms = 1000;
+
+static volatile sig_atomic_t isInterrupted = 0;
+
+static void Interrupt(int sig)
+{
+	isInterrupted = 1;
+}
+
+static uint64_t Now_ms()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static bool SendRequest(int fd, const struct sockaddr_un& publisher, bool isSubscribing)
+{
+	TelemetryRequest request;
+
+	memcpy(request.magic, "JTLR", 4);
+	request.version = TelemetryPacket::Version;
+	request.isSubscribing = isSubscribing;
+	return sendto(fd, &request, sizeof(request), 0, (const struct sockaddr*)&publisher, sizeof(publisher)) == sizeof(request);
+}
+
+static void PrintPacket(const TelemetryPacket& p, uint64_t startTime_us)
+{
+	const SensorFrame& f = p.frame;
+	uint32_t n = p.numTransitions.load(std::memory_order_relaxed);
+	int32_t modes[2] = {p.modes[0].load(std::memory_order_relaxed), p.modes[1].load(std::memory_order_relaxed)};
+
+	printf("%.3f,%u,%u,%u,%u,%#x,%u,%d,%d,%.1f,%.1f,%.2f,%.1f,%.2f,%.2f,%c,%c,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%d,%.*s\n",
+		(p.time_us - startTime_us) / 1e6, p.sequence,
+		f.edge_mV[0], f.edge_mV[1], f.edge_mV[2], f.edges, f.distance,
+		f.ticks[0], f.ticks[1], f.pose.x, f.pose.y, f.pose.heading, f.pose.odometer,
+		f.batteryVoltage, f.stateOfCharge,
+		modes[0] ? modes[0] : '-', modes[1] ? modes[1] : '-',
+		p.powers[0].load(std::memory_order_relaxed), p.powers[1].load(std::memory_order_relaxed),
+		p.speedErrors[0].load(std::memory_order_relaxed), p.speedErrors[1].load(std::memory_order_relaxed),
+		p.adjustments[0].load(std::memory_order_relaxed), p.adjustments[1].load(std::memory_order_relaxed),
+		p.controller.load(std::memory_order_relaxed), (int)TelemetryPacket::MaxStateName, p.stateNames[n & 1]);
+}
+
+int main(int argc, char* argv[])
+{
+	struct sockaddr_un publisher;
+	sa_family_t family = AF_UNIX;
+	TelemetryPacket packet;
+	unsigned long limit = 0;
+	unsigned long numReceived = 0;
+	unsigned long numMissed = 0;
+	uint32_t lastSequence = 0;
+	uint64_t startTime_us = 0;
+	uint64_t lastRequest_ms;
+	int fd;
+
+	if (argc < 2 || argc > 3 || strlen(argv[1]) >= sizeof(publisher.sun_path))
+	{
+		fprintf(stderr, "usage: telemetry_sub <socket> [packets]\n");
+		return EXIT_FAILURE;
+	}
+	if (argc == 3)
+	{
+		limit = strtoul(argv[2], 0, 10);
+	}
+
+	memset(&publisher, 0, sizeof(publisher));
+	publisher.sun_family = AF_UNIX;
+	strcpy(publisher.sun_path, argv[1]);
+
+	// bound to an address of the kernel's choosing, in the abstract namespace, so there is
+	// no file to clean up
+	if ((fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0)) < 0 || bind(fd, (struct sockaddr*)&family, sizeof(family)) < 0)
+	{
+		perror("telemetry_sub");
+		return EXIT_FAILURE;
+	}
+	if (!SendRequest(fd, publisher, true))
+	{
+		fprintf(stderr, "telemetry_sub: waiting for %s: %s\n", argv[1], strerror(errno));
+	}
+	lastRequest_ms = Now_ms();
+
+	signal(SIGINT, Interrupt);
+	signal(SIGTERM, Interrupt);
+
+	printf("time,packet,edge_left_mv,edge_front_mv,edge_right_mv,edges,range,ticks_left,ticks_right,"
+		"x,y,heading,odometer,battery_v,soc,mode_left,mode_right,power_left,power_right,"
+		"speed_error_left,speed_error_right,adjust_left,adjust_right,controller,state\n");
+
+	while (!isInterrupted && (limit == 0 || numReceived < limit))
+	{
+		struct pollfd pfd = {fd, POLLIN, 0};
+		uint64_t now_ms = Now_ms();
+
+		// renew the subscription before it lapses; the publisher may not be up yet, or
+		// may have been restarted
+		if (now_ms - lastRequest_ms >= (uint64_t)RenewPeriod_ms)
+		{
+			SendRequest(fd, publisher, true);
+			lastRequest_ms = now_ms;
+		}
+		if (poll(&pfd, 1, RenewPeriod_ms - (int)(now_ms - lastRequest_ms)) <= 0)
+			continue;
+
+		ssize_t length = recv(fd, &packet, sizeof(packet), 0);
+		if (length < 0 || !packet.IsValid(length))
+		{
+			if (length >= 0)
+				fprintf(stderr, "telemetry_sub: not a version %u telemetry packet\n", TelemetryPacket::Version);
+			continue;
+		}
+
+		if (numReceived == 0)
+			startTime_us = packet.time_us;
+		else if (packet.sequence > lastSequence + 1)
+			numMissed += packet.sequence - lastSequence - 1;
+		lastSequence = packet.sequence;
+		++numReceived;
+
+		PrintPacket(packet, startTime_us);
+		fflush(stdout);
+	}
+
+	SendRequest(fd, publisher, false);
+	close(fd);
+	fprintf(stderr, "telemetry_sub: %lu packets, %lu missed\n", numReceived, numMissed);
+	return EXIT_SUCCESS;
+}